@@ -0,0 +1,37 @@
+#ifndef binary_record_hpp
+#define binary_record_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/* Reads and writes the fixed-layout records of binary graphs (see
+   graph_binary.hpp) one field at a time. Used by graph types to give
+   write_binary and read_binary overloads for their records, so that padding
+   is always written as zeros, and bools are checked to be 0 or 1 as they are
+   read, rather than trusting whatever bytes are in the file. */
+
+template<class T>
+void binary_put(uint8_t *record, size_t offset, const T &value)
+{ memcpy(record+offset, &value, sizeof(value)); }
+
+inline void binary_put(uint8_t *record, size_t offset, bool value)
+{ record[offset]=value ? 1 : 0; }
+
+// Returns false if the field doesn't hold a valid value
+template<class T>
+bool binary_get(const uint8_t *record, size_t offset, T &value)
+{
+    memcpy(&value, record+offset, sizeof(value));
+    return true;
+}
+
+inline bool binary_get(const uint8_t *record, size_t offset, bool &value)
+{
+    if(record[offset]>1)
+        return false;
+    value=record[offset]!=0;
+    return true;
+}
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef delaunay_hpp
+#define delaunay_hpp
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+/* Delaunay triangulation of points on an integer grid, by incremental
+   (Bowyer-Watson) insertion. Points are inserted in Hilbert curve order, and
+   each is located by walking from the last triangle created, so the expected
+   cost is close to linear. Coordinates must be within +-2^24, which lets the
+   orientation test be exact in 64-bit and the in-circle test be exact in
+   128-bit arithmetic, so degenerate inputs can't break the triangulation.
+
+   The outside of the convex hull is covered by "ghost" triangles which share
+   a vertex at infinity, so there is no bounding triangle to get rid of
+   afterwards and the hull is exactly that of the points.
+
+   \param x,y  Coordinates of the points, which must be distinct.
+   \retval Every edge of the triangulation once, as (a,b) with a<b, sorted.
+*/
+inline std::vector<std::pair<uint32_t,uint32_t> > delaunay_edges(
+    const std::vector<int64_t> &x,
+    const std::vector<int64_t> &y
+){
+    typedef std::pair<uint32_t,uint32_t> edge_t;
+
+    const uint32_t INF=UINT32_MAX;
+    const uint32_t NONE=UINT32_MAX;
+    const int64_t LIMIT=int64_t(1)<<24;
+
+    uint32_t n=x.size();
+    if(y.size()!=n){
+        throw std::runtime_error("delaunay_edges - coordinate arrays differ in length.");
+    }
+    for(uint32_t i=0; i<n; i++){
+        if(x[i] < -LIMIT || x[i] > LIMIT || y[i] < -LIMIT || y[i] > LIMIT){
+            throw std::runtime_error("delaunay_edges - coordinate out of range.");
+        }
+    }
+    if(n<3){
+        std::vector<edge_t> res;
+        if(n==2){
+            res.push_back(edge_t(0,1));
+        }
+        return res;
+    }
+
+    auto orient=[&](uint32_t a, uint32_t b, uint32_t c) -> int
+    {
+        int64_t d=(x[b]-x[a])*(y[c]-y[a]) - (y[b]-y[a])*(x[c]-x[a]);
+        return (d>0) - (d<0);
+    };
+
+    // >0 if d is strictly inside the circumcircle of ccw triangle abc
+    auto incircle=[&](uint32_t a, uint32_t b, uint32_t c, uint32_t d) -> int
+    {
+        int64_t adx=x[a]-x[d], ady=y[a]-y[d];
+        int64_t bdx=x[b]-x[d], bdy=y[b]-y[d];
+        int64_t cdx=x[c]-x[d], cdy=y[c]-y[d];
+        __int128 alift=(__int128)(adx*adx+ady*ady);
+        __int128 blift=(__int128)(bdx*bdx+bdy*bdy);
+        __int128 clift=(__int128)(cdx*cdx+cdy*cdy);
+        __int128 det = alift*(bdx*cdy-cdx*bdy)
+                     + blift*(cdx*ady-adx*cdy)
+                     + clift*(adx*bdy-bdx*ady);
+        return (det>0) - (det<0);
+    };
+
+    // Triangles are ccw, and nbr[i] is across the edge opposite v[i]. A ghost
+    // triangle has INF in one slot, and its other two vertices are a hull edge.
+    struct triangle
+    {
+        uint32_t v[3];
+        uint32_t nbr[3];
+        uint32_t mark;      // Last insertion this triangle was visited by
+    };
+    std::vector<triangle> tris;
+    std::vector<uint32_t> freeTris;
+    tris.reserve(2*n+8);
+
+    auto is_ghost=[&](uint32_t t) -> bool
+    { return tris[t].v[0]==INF || tris[t].v[1]==INF || tris[t].v[2]==INF; };
+
+    auto in_conflict=[&](uint32_t t, uint32_t p) -> bool
+    {
+        const triangle &tri=tris[t];
+        for(unsigned i=0; i<3; i++){
+            if(tri.v[i]==INF){
+                // The hull edge, as it runs in the ghost's ccw order
+                uint32_t u=tri.v[(i+1)%3], w=tri.v[(i+2)%3];
+                int o=orient(u, w, p);
+                if(o!=0)
+                    return o>0;
+                // Collinear with the hull edge, so only conflicts if it splits it
+                return std::min(x[u],x[w])<=x[p] && x[p]<=std::max(x[u],x[w])
+                    && std::min(y[u],y[w])<=y[p] && y[p]<=std::max(y[u],y[w]);
+            }
+        }
+        return incircle(tri.v[0], tri.v[1], tri.v[2], p) > 0;
+    };
+
+    auto new_triangle=[&](uint32_t a, uint32_t b, uint32_t c) -> uint32_t
+    {
+        uint32_t t;
+        if(!freeTris.empty()){
+            t=freeTris.back();
+            freeTris.pop_back();
+        }else{
+            t=tris.size();
+            tris.push_back(triangle());
+        }
+        tris[t].v[0]=a; tris[t].v[1]=b; tris[t].v[2]=c;
+        tris[t].nbr[0]=tris[t].nbr[1]=tris[t].nbr[2]=NONE;
+        tris[t].mark=0;
+        return t;
+    };
+
+    // Insertion order along a Hilbert curve
+    std::vector<uint32_t> order(n);
+    {
+        int64_t minX=x[0], maxX=x[0], minY=y[0], maxY=y[0];
+        for(uint32_t i=1; i<n; i++){
+            minX=std::min(minX, x[i]); maxX=std::max(maxX, x[i]);
+            minY=std::min(minY, y[i]); maxY=std::max(maxY, y[i]);
+        }
+        int64_t span=std::max<int64_t>(1, std::max(maxX-minX, maxY-minY));
+
+        std::vector<std::pair<uint64_t,uint32_t> > keys(n);
+        for(uint32_t i=0; i<n; i++){
+            uint32_t hx=uint32_t(((x[i]-minX)*65535)/span);
+            uint32_t hy=uint32_t(((y[i]-minY)*65535)/span);
+            uint64_t d=0;
+            for(uint32_t s=1u<<15; s>0; s>>=1){
+                uint32_t rx=(hx&s)>0, ry=(hy&s)>0;
+                d += uint64_t(s)*s*((3*rx)^ry);
+                if(ry==0){
+                    if(rx==1){
+                        hx=65535-hx;
+                        hy=65535-hy;
+                    }
+                    std::swap(hx, hy);
+                }
+            }
+            keys[i]=std::make_pair(d, i);
+        }
+        std::sort(keys.begin(), keys.end());
+        for(uint32_t i=0; i<n; i++){
+            order[i]=keys[i].second;
+        }
+    }
+
+    // Seed with the first three points (in curve order) which aren't collinear
+    uint32_t seedA=order[0], seedB=order[1], seedC=NONE;
+    uint32_t seedPos=NONE;
+    for(uint32_t i=2; i<n; i++){
+        if(orient(seedA, seedB, order[i])!=0){
+            seedC=order[i];
+            seedPos=i;
+            break;
+        }
+    }
+    if(seedC==NONE){
+        // All collinear, so the triangulation is just the chain of points
+        std::vector<uint32_t> line(order);
+        std::sort(line.begin(), line.end(), [&](uint32_t a, uint32_t b){
+            return x[a]<x[b] || (x[a]==x[b] && y[a]<y[b]);
+        });
+        std::vector<edge_t> res;
+        for(uint32_t i=0; i+1<n; i++){
+            res.push_back(edge_t(std::min(line[i],line[i+1]), std::max(line[i],line[i+1])));
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+    if(orient(seedA, seedB, seedC)<0){
+        std::swap(seedB, seedC);
+    }
+    {
+        uint32_t t=new_triangle(seedA, seedB, seedC);
+        uint32_t gAB=new_triangle(seedB, seedA, INF);
+        uint32_t gBC=new_triangle(seedC, seedB, INF);
+        uint32_t gCA=new_triangle(seedA, seedC, INF);
+        tris[t].nbr[0]=gBC; tris[t].nbr[1]=gCA; tris[t].nbr[2]=gAB;
+        // Ghost (u,w,INF) : across u is the ghost sharing w, across w the one sharing u
+        tris[gAB].nbr[2]=t; tris[gAB].nbr[0]=gCA; tris[gAB].nbr[1]=gBC;
+        tris[gBC].nbr[2]=t; tris[gBC].nbr[0]=gAB; tris[gBC].nbr[1]=gCA;
+        tris[gCA].nbr[2]=t; tris[gCA].nbr[0]=gBC; tris[gCA].nbr[1]=gAB;
+    }
+
+    uint32_t last=0;    // Where to start walking from
+    uint32_t stamp=0;
+    uint32_t walkState=1;
+
+    std::vector<uint32_t> cavity, stack;
+    struct boundary_edge
+    {
+        uint32_t a, b;      // Edge in the orientation of the cavity triangle
+        uint32_t outside;   // Triangle across it, or NONE
+        uint32_t outsideSlot;
+        uint32_t t;         // New triangle built on it
+    };
+    std::vector<boundary_edge> boundary;
+
+    for(uint32_t oi=2; oi<n; oi++){
+        if(oi==seedPos)
+            continue;
+        uint32_t p=order[oi];
+        stamp++;
+
+        // Walk towards p, until it is inside the current triangle or we step outside the hull
+        uint32_t t=last;
+        if(is_ghost(t)){
+            for(unsigned i=0; i<3; i++){
+                if(tris[t].v[i]==INF){
+                    t=tris[t].nbr[i];
+                    break;
+                }
+            }
+        }
+        // This is a remembering stochastic walk: it never steps straight
+        // back, and tries the edges starting from a pseudo-random one, as a
+        // fixed order can cycle when points are cocircular
+        uint32_t prev=NONE;
+        while(1){
+            const triangle &tri=tris[t];
+            if(is_ghost(t))
+                break;
+            walkState=walkState*1103515245u+12345u;
+            unsigned rot=(walkState>>16)%3;
+            bool moved=false;
+            for(unsigned k=0; k<3; k++){
+                unsigned i=(k+rot)%3;
+                if(tri.nbr[i]!=prev && orient(tri.v[(i+1)%3], tri.v[(i+2)%3], p) < 0){
+                    prev=t;
+                    t=tri.nbr[i];
+                    moved=true;
+                    break;
+                }
+            }
+            if(!moved)
+                break;
+        }
+
+        // Grow the cavity of triangles whose circumcircle contains p
+        cavity.clear();
+        boundary.clear();
+        if(!in_conflict(t, p)){
+            throw std::runtime_error("delaunay_edges - point location failed (duplicate point?).");
+        }
+        stack.assign(1, t);
+        tris[t].mark=stamp;
+        while(!stack.empty()){
+            uint32_t c=stack.back();
+            stack.pop_back();
+            cavity.push_back(c);
+            for(unsigned i=0; i<3; i++){
+                uint32_t nb=tris[c].nbr[i];
+                uint32_t a=tris[c].v[(i+1)%3], b=tris[c].v[(i+2)%3];
+                if(tris[nb].mark==stamp){
+                    continue;
+                }
+                if(in_conflict(nb, p)){
+                    tris[nb].mark=stamp;
+                    stack.push_back(nb);
+                }else{
+                    unsigned slot=0;
+                    while(tris[nb].nbr[slot]!=c){
+                        slot++;
+                    }
+                    boundary.push_back(boundary_edge{a, b, nb, slot, NONE});
+                }
+            }
+        }
+
+        // New triangles reuse the slots of the cavity
+        for(uint32_t i=0; i<cavity.size(); i++){
+            freeTris.push_back(cavity[i]);
+        }
+
+        // Fan of new triangles (a,b,p) around p
+        for(uint32_t i=0; i<boundary.size(); i++){
+            boundary_edge &e=boundary[i];
+            e.t=new_triangle(e.a, e.b, p);
+            tris[e.t].mark=stamp;
+            tris[e.t].nbr[2]=e.outside;
+            tris[e.outside].nbr[e.outsideSlot]=e.t;
+        }
+        for(uint32_t i=0; i<boundary.size(); i++){
+            boundary_edge &e=boundary[i];
+            for(uint32_t j=0; j<boundary.size(); j++){
+                if(boundary[j].a==e.b){
+                    tris[e.t].nbr[0]=boundary[j].t;     // Across (b,p)
+                }
+                if(boundary[j].b==e.a){
+                    tris[e.t].nbr[1]=boundary[j].t;     // Across (p,a)
+                }
+            }
+            if(!is_ghost(e.t)){
+                last=e.t;
+            }
+        }
+    }
+
+    // Collect each real edge once
+    std::vector<bool> dead(tris.size(), false);
+    for(uint32_t i=0; i<freeTris.size(); i++){
+        dead[freeTris[i]]=true;
+    }
+    std::vector<edge_t> res;
+    res.reserve(3*n);
+    for(uint32_t t=0; t<tris.size(); t++){
+        if(dead[t] || is_ghost(t))
+            continue;
+        for(unsigned i=0; i<3; i++){
+            uint32_t a=tris[t].v[(i+1)%3], b=tris[t].v[(i+2)%3];
+            uint32_t nb=tris[t].nbr[i];
+            if(a<b || is_ghost(nb)){
+                res.push_back(edge_t(std::min(a,b), std::max(a,b)));
+            }
+        }
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef device_rng_hpp
+#define device_rng_hpp
+
+#include <cstdint>
+
+/* Small counter-based random number generator (splitmix64), used by the
+   generators to give each device its own stream keyed on (seed,index). The
+   values for a device can then be regenerated at any point, so generators
+   can write nodes and edges in separate passes without storing the graph. */
+class device_rng
+{
+private:
+    uint64_t m_state;
+
+    static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+public:
+    device_rng(uint64_t seed, uint64_t index)
+        : m_state(mix(seed*0x9E3779B97F4A7C15ull + index))
+    {}
+
+    uint64_t next()
+    {
+        m_state += 0x9E3779B97F4A7C15ull;
+        return mix(m_state);
+    }
+
+    // Uniform in [0,1)
+    double uniform()
+    { return (next()>>11) * (1.0/9007199254740992.0); }
+};
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef graph_binary_hpp
+#define graph_binary_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "binary_record.hpp"
+
+/* Binary graph format, which holds the same information as the POETSGraph
+   text format but can be memory mapped and used without parsing:
+
+     graph_binary_header
+     graph properties, as the text written by operator<< (graphTextSize bytes)
+     properties_type[numDevices]                    at nodesOffset
+     graph_binary_edge<channel_type>[numChannels]   at edgesOffset
+
+   Records have the layout of the in-memory structs of the graph type, in
+   host byte order, so a file can only be read by a build with the same
+   layout; the header records enough to detect when that isn't the case.
+   Edges keep the column order of the text format. Graph types give
+   write_binary and read_binary overloads for their records, which go field
+   by field so that padding is written as zeros and bad bools are rejected
+   (see binary_record.hpp).
+*/
+
+enum graph_format
+{
+    graph_format_text,      // POETSGraph text
+    graph_format_binary     // graph_binary_header and friends
+};
+
+// First byte can't start a text graph, so the format can be sniffed from a stream
+static const char graph_binary_magic[8]={'\x89','P','O','E','T','S','G','B'};
+
+static const uint32_t graph_binary_byte_order=0x01020304;
+
+struct graph_binary_header
+{
+    char magic[8];              // graph_binary_magic
+    uint32_t byteOrder;         // graph_binary_byte_order, as written by the producer
+    uint32_t headerSize;        // sizeof(graph_binary_header)
+    char typeName[32];          // Zero padded TGraph::type_name()
+    uint32_t propertiesSize;    // sizeof(properties_type)
+    uint32_t edgeSize;          // sizeof(graph_binary_edge<channel_type>)
+    uint32_t numDevices;
+    uint32_t numChannels;
+    uint64_t graphTextSize;
+    uint64_t nodesOffset;
+    uint64_t edgesOffset;
+    uint64_t fileSize;
+};
+
+template<class TChannel>
+struct graph_binary_edge
+{
+    uint32_t dst;   // First column of the text format
+    uint32_t src;   // Second column of the text format
+    uint32_t delay;
+    TChannel channel;
+};
+
+// Offset of each section, with the arrays aligned to a cache line
+inline uint64_t graph_binary_align(uint64_t offset)
+{ return (offset+63) & ~uint64_t(63); }
+
+/* Writes a binary graph to a stream one record at a time, so the caller
+   doesn't need to hold the whole graph in the binary layout. The number of
+   devices and channels written must match those given to the constructor. */
+template<class TGraph>
+class GraphBinaryWriter
+{
+public:
+    typedef typename TGraph::graph_type graph_type;
+    typedef typename TGraph::properties_type properties_type;
+    typedef typename TGraph::channel_type channel_type;
+    typedef graph_binary_edge<channel_type> edge_type;
+
+    static_assert(std::is_trivially_copyable<properties_type>::value, "Binary graphs need trivially copyable device properties.");
+    static_assert(std::is_trivially_copyable<channel_type>::value, "Binary graphs need trivially copyable channel properties.");
+private:
+    std::ostream &m_dst;
+    graph_binary_header m_header;
+    uint64_t m_offset;
+    uint32_t m_nodesWritten, m_edgesWritten;
+
+    void pad_to(uint64_t offset)
+    {
+        static const char zeros[64]={0};
+        while(m_offset < offset){
+            unsigned n=std::min<uint64_t>(sizeof(zeros), offset-m_offset);
+            m_dst.write(zeros, n);
+            m_offset+=n;
+        }
+    }
+public:
+    GraphBinaryWriter(std::ostream &dst, const graph_type &graph, unsigned numDevices, unsigned numChannels)
+        : m_dst(dst)
+        , m_offset(0)
+        , m_nodesWritten(0)
+        , m_edgesWritten(0)
+    {
+        std::stringstream tmp;
+        tmp<<graph;
+        std::string graphText=tmp.str();
+
+        if(strlen(TGraph::type_name()) >= sizeof(m_header.typeName)){
+            throw std::runtime_error("GraphBinaryWriter - graph type name is too long.");
+        }
+
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(m_header.magic, graph_binary_magic, sizeof(graph_binary_magic));
+        m_header.byteOrder=graph_binary_byte_order;
+        m_header.headerSize=sizeof(graph_binary_header);
+        strcpy(m_header.typeName, TGraph::type_name());
+        m_header.propertiesSize=sizeof(properties_type);
+        m_header.edgeSize=sizeof(edge_type);
+        m_header.numDevices=numDevices;
+        m_header.numChannels=numChannels;
+        m_header.graphTextSize=graphText.size();
+        m_header.nodesOffset=graph_binary_align(sizeof(graph_binary_header)+graphText.size());
+        m_header.edgesOffset=graph_binary_align(m_header.nodesOffset+uint64_t(numDevices)*sizeof(properties_type));
+        m_header.fileSize=m_header.edgesOffset+uint64_t(numChannels)*sizeof(edge_type);
+
+        m_dst.write((const char*)&m_header, sizeof(m_header));
+        m_dst.write(graphText.data(), graphText.size());
+        m_offset=sizeof(m_header)+graphText.size();
+    }
+
+    void writeDevice(const properties_type &properties)
+    {
+        if(m_nodesWritten==m_header.numDevices){
+            throw std::runtime_error("GraphBinaryWriter::writeDevice - more devices than declared.");
+        }
+        pad_to(m_header.nodesOffset);
+        uint8_t record[sizeof(properties_type)];
+        write_binary(record, properties);
+        m_dst.write((const char*)record, sizeof(record));
+        m_offset+=sizeof(record);
+        m_nodesWritten++;
+    }
+
+    void writeChannel(unsigned dstColumn, unsigned srcColumn, unsigned delay, const channel_type &channel)
+    {
+        if(m_nodesWritten!=m_header.numDevices){
+            throw std::runtime_error("GraphBinaryWriter::writeChannel - not all devices have been written.");
+        }
+        if(m_edgesWritten==m_header.numChannels){
+            throw std::runtime_error("GraphBinaryWriter::writeChannel - more channels than declared.");
+        }
+        pad_to(m_header.edgesOffset);
+        uint8_t record[sizeof(edge_type)];
+        memset(record, 0, sizeof(record));
+        binary_put(record, offsetof(edge_type,dst), uint32_t(dstColumn));
+        binary_put(record, offsetof(edge_type,src), uint32_t(srcColumn));
+        binary_put(record, offsetof(edge_type,delay), uint32_t(delay));
+        write_binary(record+offsetof(edge_type,channel), channel);
+        m_dst.write((const char*)record, sizeof(record));
+        m_offset+=sizeof(record);
+        m_edgesWritten++;
+    }
+
+    void finish()
+    {
+        if(m_nodesWritten!=m_header.numDevices || m_edgesWritten!=m_header.numChannels){
+            throw std::runtime_error("GraphBinaryWriter::finish - fewer devices or channels than declared.");
+        }
+        pad_to(m_header.edgesOffset);   // In case there are no edges
+        m_dst.flush();
+    }
+};
+
+
+/* The bytes of a binary graph, either mapped from a file or read from a
+   stream (e.g. stdin) into memory. */
+class GraphBinaryData
+{
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+    void *m_mapping;
+    std::vector<uint8_t> m_buffer;
+
+    GraphBinaryData(const GraphBinaryData &) = delete;
+    GraphBinaryData &operator=(const GraphBinaryData &) = delete;
+public:
+    GraphBinaryData(const char *path)
+        : m_data(0)
+        , m_size(0)
+        , m_mapping(0)
+    {
+        int fd=open(path, O_RDONLY);
+        if(fd<0){
+            throw std::runtime_error("GraphBinaryData - couldn't open '"+std::string(path)+"'.");
+        }
+        struct stat st;
+        if(fstat(fd, &st)<0){
+            close(fd);
+            throw std::runtime_error("GraphBinaryData - couldn't stat '"+std::string(path)+"'.");
+        }
+        m_size=st.st_size;
+        if(m_size>0){
+            m_mapping=mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(m_mapping==MAP_FAILED){
+                close(fd);
+                throw std::runtime_error("GraphBinaryData - couldn't map '"+std::string(path)+"'.");
+            }
+            m_data=(const uint8_t*)m_mapping;
+        }
+        close(fd);
+    }
+
+    GraphBinaryData(std::istream &src)
+        : m_data(0)
+        , m_size(0)
+        , m_mapping(0)
+    {
+        char tmp[65536];
+        while(src.read(tmp, sizeof(tmp)) || src.gcount()){
+            m_buffer.insert(m_buffer.end(), tmp, tmp+src.gcount());
+        }
+        m_data=m_buffer.data();
+        m_size=m_buffer.size();
+    }
+
+    ~GraphBinaryData()
+    {
+        if(m_mapping){
+            munmap(m_mapping, m_size);
+        }
+    }
+
+    const uint8_t *data() const
+    { return m_data; }
+
+    size_t size() const
+    { return m_size; }
+
+    const graph_binary_header &header() const
+    {
+        if(m_size < sizeof(graph_binary_header) || memcmp(m_data, graph_binary_magic, sizeof(graph_binary_magic))){
+            throw std::runtime_error("GraphBinaryData - not a binary graph.");
+        }
+        const graph_binary_header *h=(const graph_binary_header*)m_data;
+        if(h->byteOrder!=graph_binary_byte_order || h->headerSize!=sizeof(graph_binary_header)){
+            throw std::runtime_error("GraphBinaryData - binary graph was written by an incompatible build.");
+        }
+        if(h->fileSize!=m_size){
+            throw std::runtime_error("GraphBinaryData - binary graph is truncated.");
+        }
+        return *h;
+    }
+};
+
+// Checks whether the next thing in the stream is a binary graph
+inline bool graph_is_binary(std::istream &src)
+{ return src.peek()==(unsigned char)graph_binary_magic[0]; }
+
+/* Equivalent of graph_load_type, graph_load_header, and graph_load_body for
+   binary graphs. */
+inline std::string graph_binary_load_type(const GraphBinaryData &src)
+{
+    const graph_binary_header &h=src.header();
+    return std::string(h.typeName, strnlen(h.typeName, sizeof(h.typeName)));
+}
+
+template<class TGraph>
+void graph_binary_load_header(
+    const GraphBinaryData &src,
+    typename TGraph::graph_type &graph,
+    unsigned &deviceCount,
+    unsigned &channelCount
+){
+    typedef graph_binary_edge<typename TGraph::channel_type> edge_type;
+
+    const graph_binary_header &h=src.header();
+    if(graph_binary_load_type(src)!=TGraph::type_name()){
+        throw std::runtime_error("graph_binary_load_header - graph type doesn't match.");
+    }
+    if(h.propertiesSize!=sizeof(typename TGraph::properties_type) || h.edgeSize!=sizeof(edge_type)){
+        throw std::runtime_error("graph_binary_load_header - record sizes don't match this build.");
+    }
+    if(h.nodesOffset < sizeof(h)+h.graphTextSize || h.nodesOffset%64
+        || h.edgesOffset < h.nodesOffset+uint64_t(h.numDevices)*h.propertiesSize || h.edgesOffset%64
+        || h.fileSize < h.edgesOffset+uint64_t(h.numChannels)*h.edgeSize
+    ){
+        throw std::runtime_error("graph_binary_load_header - inconsistent section offsets.");
+    }
+
+    std::string graphText((const char*)src.data()+sizeof(h), h.graphTextSize);
+    if(! (std::stringstream(graphText) >> graph) ){
+        throw std::runtime_error("graph_binary_load_header - Couldn't read graph properties");
+    }
+
+    deviceCount=h.numDevices;
+    channelCount=h.numChannels;
+}
+
+template<class TGraphBuilder>
+void graph_binary_load_body(
+    const GraphBinaryData &src,
+    unsigned numDevices, unsigned numChannels,
+    TGraphBuilder &dst
+){
+    typedef typename TGraphBuilder::properties_type properties_type;
+    typedef graph_binary_edge<typename TGraphBuilder::channel_type> edge_type;
+
+    const graph_binary_header &h=src.header();
+    if(h.numDevices!=numDevices || h.numChannels!=numChannels){
+        throw std::runtime_error("graph_binary_load_body - counts don't match header.");
+    }
+
+    const uint8_t *nodes=src.data()+h.nodesOffset;
+    for(unsigned i=0; i<numDevices; i++){
+        properties_type properties;
+        if(!read_binary(nodes+uint64_t(i)*sizeof(properties_type), properties)){
+            throw std::runtime_error("graph_binary_load_body - invalid device record.");
+        }
+        dst.addDevice(properties);
+    }
+
+    const uint8_t *edges=src.data()+h.edgesOffset;
+    for(unsigned i=0; i<numChannels; i++){
+        const uint8_t *record=edges+uint64_t(i)*sizeof(edge_type);
+        uint32_t dstColumn, srcColumn, delay;
+        typename TGraphBuilder::channel_type channel;
+        binary_get(record, offsetof(edge_type,dst), dstColumn);
+        binary_get(record, offsetof(edge_type,src), srcColumn);
+        binary_get(record, offsetof(edge_type,delay), delay);
+        if(!read_binary(record+offsetof(edge_type,channel), channel)){
+            throw std::runtime_error("graph_binary_load_body - invalid channel record.");
+        }
+        dst.addChannel(dstColumn, srcColumn, delay, channel);
+    }
+}
+
+#endif
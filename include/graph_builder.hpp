@@ -1,5 +1,5 @@
-#ifndef writer_hpp
-#define writer_hpp
+#ifndef graph_builder_hpp
+#define graph_builder_hpp
 
 #include <cstdint>
 #include <vector>
@@ -9,6 +9,174 @@
 #include <cstdlib>
 #include <iostream>
 
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+#include "graph_binary.hpp"
+
+/* Output buffer which collects writes into large blocks before passing them
+   on to another stream buffer, so formatting records one at a time doesn't
+   mean a call into the destination stream for each field. */
+class block_output_buffer
+    : public std::streambuf
+{
+private:
+    std::streambuf *m_dst;
+    std::vector<char> m_buffer;
+    
+    bool write_block()
+    {
+        std::streamsize n=pptr()-pbase();
+        if(n>0 && m_dst->sputn(pbase(), n)!=n)
+            return false;
+        setp(m_buffer.data(), m_buffer.data()+m_buffer.size());
+        return true;
+    }
+protected:
+    int_type overflow(int_type c) override
+    {
+        if(!write_block())
+            return traits_type::eof();
+        if(!traits_type::eq_int_type(c, traits_type::eof())){
+            *pptr()=traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    
+    int sync() override
+    {
+        if(!write_block())
+            return -1;
+        return m_dst->pubsync();
+    }
+public:
+    block_output_buffer(std::streambuf *dst, size_t size=1<<20)
+        : m_dst(dst)
+        , m_buffer(size)
+    {
+        setp(m_buffer.data(), m_buffer.data()+m_buffer.size());
+    }
+    
+    ~block_output_buffer()
+    {
+        write_block();
+    }
+};
+
+/* Writes a graph as the devices and channels are added, rather than holding
+   it in memory like GraphBuilder. The counts have to be known up front, as
+   they are in the header, and all devices must be added before any channels.
+   Output goes through a large buffer, and is complete once finish() returns. */
+template<class TGraph>
+class GraphStreamBuilder
+{
+private:
+    typedef typename TGraph::graph_type graph_type;
+    typedef typename TGraph::properties_type properties_type;
+    typedef typename TGraph::channel_type channel_type;
+    
+    block_output_buffer m_buffer;
+    std::ostream m_dst;
+    graph_format m_format;
+    std::unique_ptr<GraphBinaryWriter<TGraph> > m_binary;
+    
+    unsigned m_numDevices, m_numChannels;
+    unsigned m_devicesWritten, m_channelsWritten;
+    
+    void begin_edges()
+    {
+        if(m_devicesWritten!=m_numDevices){
+            throw std::runtime_error("GraphStreamBuilder::addChannel - all devices must be added before channels.");
+        }
+        if(m_format==graph_format_text && m_channelsWritten==0){
+            m_dst<<"EndNodes\n";
+            m_dst<<"BeginEdges\n";
+        }
+    }
+public:
+    GraphStreamBuilder(
+        std::ostream &dst,
+        const graph_type &graph,
+        unsigned numDevices,
+        unsigned numChannels,
+        graph_format format=graph_format_text
+    )
+        : m_buffer(dst.rdbuf())
+        , m_dst(&m_buffer)
+        , m_format(format)
+        , m_numDevices(numDevices)
+        , m_numChannels(numChannels)
+        , m_devicesWritten(0)
+        , m_channelsWritten(0)
+    {
+        if(m_format==graph_format_binary){
+            m_binary.reset(new GraphBinaryWriter<TGraph>(m_dst, graph, numDevices, numChannels));
+        }else{
+            m_dst<<"POETSGraph\n";
+            m_dst<<TGraph::type_name()<<"\n";
+            
+            m_dst<<"BeginHeader\n";
+            m_dst<<TGraph::type_name()<<"\n";    // Write it again, for error checking
+            m_dst<<numDevices<<" "<<numChannels<<"\n";
+            m_dst<<graph<<"\n";
+            m_dst<<"EndHeader\n";
+            
+            m_dst<<"BeginNodes\n";
+        }
+    }
+    
+    unsigned addDevice(
+        const properties_type &device
+    ){
+        if(m_devicesWritten==m_numDevices){
+            throw std::runtime_error("GraphStreamBuilder::addDevice - more devices than declared.");
+        }
+        if(m_binary){
+            m_binary->writeDevice(device);
+        }else{
+            m_dst<<device<<"\n";
+        }
+        return m_devicesWritten++;
+    }
+    
+    void addChannel(
+        unsigned srcIndex,
+        unsigned dstIndex,
+        unsigned delay,
+        const channel_type &channel
+    ){
+        if(m_channelsWritten==m_numChannels){
+            throw std::runtime_error("GraphStreamBuilder::addChannel - more channels than declared.");
+        }
+        begin_edges();
+        if(m_binary){
+            m_binary->writeChannel(dstIndex, srcIndex, delay, channel);
+        }else{
+            m_dst<<dstIndex<<" "<<srcIndex<<" "<<delay<<" "<<channel<<"\n";
+        }
+        m_channelsWritten++;
+    }
+    
+    void finish()
+    {
+        if(m_channelsWritten!=m_numChannels){
+            throw std::runtime_error("GraphStreamBuilder::finish - fewer channels than declared.");
+        }
+        begin_edges();
+        if(m_binary){
+            m_binary->finish();
+        }else{
+            m_dst<<"EndEdges\n";
+        }
+        m_dst.flush();
+        if(!m_dst){
+            throw std::runtime_error("GraphStreamBuilder::finish - couldn't write graph.");
+        }
+    }
+};
+
 template<class TGraph>
 class GraphBuilder
 {
@@ -67,28 +235,16 @@ public:
         m_edges.push_back(e);
     }
     
-    void write(std::ostream &dst) const
+    void write(std::ostream &dst, graph_format format=graph_format_text) const
     {
-        dst<<"POETSGraph"<<std::endl;
-        dst<<TGraph::type_name()<<std::endl;
-        
-        dst<<"BeginHeader"<<std::endl;
-        dst<<TGraph::type_name()<<std::endl;    // Write it again, for error checking
-        dst<<m_nodes.size()<<" "<<m_edges.size()<<std::endl;
-        dst<<m_graph<<std::endl;
-        dst<<"EndHeader"<<std::endl;
-        
-        dst<<"BeginNodes"<<std::endl;
+        GraphStreamBuilder<TGraph> writer(dst, m_graph, m_nodes.size(), m_edges.size(), format);
         for(unsigned i=0; i<m_nodes.size(); i++){
-            dst<<m_nodes[i].properties<<std::endl;
+            writer.addDevice(m_nodes[i].properties);
         }
-        dst<<"EndNodes"<<std::endl;
-        
-        dst<<"BeginEdges"<<std::endl;
         for(unsigned i=0; i<m_edges.size(); i++){
-            dst<<m_edges[i].dst<<" "<<m_edges[i].src<<" "<<m_edges[i].delay<<" "<<m_edges[i].channel<<std::endl;
+            writer.addChannel(m_edges[i].src, m_edges[i].dst, m_edges[i].delay, m_edges[i].channel);
         }
-        dst<<"EndEdges"<<std::endl;
+        writer.finish();
     }
 };
 
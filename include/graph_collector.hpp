@@ -0,0 +1,36 @@
+#ifndef graph_collector_hpp
+#define graph_collector_hpp
+
+#include <vector>
+
+/* Target for graph_load_body and graph_binary_load_body which just keeps
+   everything, for tools that transform a graph before writing it out. */
+template<class TGraph>
+struct GraphCollector
+{
+    typedef typename TGraph::properties_type properties_type;
+    typedef typename TGraph::channel_type channel_type;
+
+    struct edge
+    {
+        unsigned a, b;  // Indices as passed to addChannel
+        unsigned delay;
+        channel_type channel;
+    };
+
+    std::vector<properties_type> nodes;
+    std::vector<edge> edges;
+
+    unsigned addDevice(const properties_type &device)
+    {
+        nodes.push_back(device);
+        return nodes.size()-1;
+    }
+
+    void addChannel(unsigned a, unsigned b, unsigned delay, const channel_type &channel)
+    {
+        edges.push_back(edge{a, b, delay, channel});
+    }
+};
+
+#endif
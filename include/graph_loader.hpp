@@ -1,5 +1,5 @@
-#ifndef writer_hpp
-#define writer_hpp
+#ifndef graph_loader_hpp
+#define graph_loader_hpp
 
 #include <cstdint>
 #include <vector>
@@ -9,6 +9,13 @@
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+
+#include "thread_team.hpp"
+#include "text_cursor.hpp"
 
 std::string nextline(unsigned &lineNumber, std::istream &src)
 {
@@ -75,6 +82,10 @@ void graph_load_header(
     
 }
 
+/* Splits the remaining text into roughly equal chunks of whole lines, finds
+   the line number each chunk starts at, then parses the chunks in parallel.
+   Nothing is allocated per line, and records are parsed by parse_text, which
+   graph types can overload for their properties and channels. */
 template<class TGraphBuilder>
 void graph_load_body(
     unsigned &lineNumber,
@@ -85,37 +96,146 @@ void graph_load_body(
     typedef typename TGraphBuilder::properties_type properties_type;
     typedef typename TGraphBuilder::channel_type channel_type;
     
-    std::stringstream err;
+    struct edge_record
+    {
+        unsigned dstIndex, srcIndex;
+        unsigned delay;
+        channel_type channel;
+    };
     
-    expect(lineNumber, src, "BeginNodes");
+    struct chunk
+    {
+        const char *begin, *end;
+        uint64_t firstLine;     // Index of first line within the body
+        uint64_t numLines;
+        uint64_t errorLine;     // Index of first line with an error, or UINT64_MAX
+        std::string error;
+    };
     
-    std::vector<unsigned> devices;
-    for(unsigned i=0; i<numDevices; i++){
-        properties_type properties;
-        if(! ( std::stringstream(nextline(lineNumber, src)) >> properties ) ){
-            err<<"At line "<<lineNumber<<" : Couldn't read node "<<i;
-            throw std::runtime_error(err.str());
+    // The body is BeginNodes, nodes, EndNodes, BeginEdges, edges, EndEdges
+    const uint64_t bodyLines=uint64_t(numDevices)+numChannels+4;
+    const uint64_t nodesBegin=1, edgesBegin=numDevices+3;
+    
+    std::vector<char> text;
+    {
+        const size_t block=1<<20;
+        size_t got=0;
+        do{
+            text.resize(got+block);
+            got += src.rdbuf()->sgetn(&text[got], block);
+        }while(got==text.size());
+        text.resize(got);
+    }
+    const char *textBegin=text.data(), *textEnd=text.data()+text.size();
+    
+    unsigned numThreads=std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), 1+text.size()/(1<<20));
+    numThreads=std::min(numThreads, 16u);
+    
+    std::vector<chunk> chunks(numThreads);
+    for(unsigned i=0; i<numThreads; i++){
+        chunk &c=chunks[i];
+        c.begin = i==0 ? textBegin : chunks[i-1].end;
+        c.end = textBegin + text.size()*(i+1)/numThreads;
+        if(c.end < c.begin){
+            c.end=c.begin;
+        }
+        if(i+1==numThreads){
+            c.end=textEnd;
+        }else if(c.begin < c.end){
+            // Extend to just past the end of the line
+            const char *nl=(const char*)memchr(c.end-1, '\n', textEnd-(c.end-1));
+            c.end = nl ? nl+1 : textEnd;
         }
-        unsigned deviceIndex = dst.addDevice(properties);
-        devices.push_back(deviceIndex);
+        c.errorLine=UINT64_MAX;
     }
-    expect(lineNumber, src, "EndNodes");
     
-    expect(lineNumber, src, "BeginEdges");
-    for(unsigned i=0; i<numChannels; i++){
-        unsigned dstIndex, srcIndex;
-        channel_type channel;
-        unsigned delay;
-        
-        if(! ( std::stringstream(nextline(lineNumber, src)) >> dstIndex >> srcIndex >> delay >> channel ) ){
-            err<<"At line "<<lineNumber<<" : Couldn't read node "<<i;
-            throw std::runtime_error(err.str());
+    std::vector<properties_type> nodes(numDevices);
+    std::vector<edge_record> edges(numChannels);
+    
+    ThreadTeam team(numThreads);
+    
+    // Count the lines (i.e. line starts) in each chunk
+    team.run([&](unsigned t){
+        chunk &c=chunks[t];
+        c.numLines=0;
+        for(const char *p=c.begin; p<c.end; ){
+            c.numLines++;
+            const char *nl=(const char*)memchr(p, '\n', c.end-p);
+            p = nl ? nl+1 : c.end;
         }
+    });
+    uint64_t totalLines=0;
+    for(unsigned i=0; i<numThreads; i++){
+        chunks[i].firstLine=totalLines;
+        totalLines+=chunks[i].numLines;
+    }
+    
+    team.run([&](unsigned t){
+        chunk &c=chunks[t];
+        std::stringstream err;
         
-        dst.addChannel(dstIndex, srcIndex, delay, channel);
-        
+        uint64_t index=c.firstLine;
+        for(const char *p=c.begin; p<c.end && index<bodyLines; index++){
+            const char *nl=(const char*)memchr(p, '\n', c.end-p);
+            text_cursor line{p, nl ? nl : c.end};
+            p = nl ? nl+1 : c.end;
+            
+            unsigned lineNo=lineNumber+1+index;
+            
+            if(index>=nodesBegin && index<nodesBegin+numDevices){
+                unsigned i=index-nodesBegin;
+                if(!parse_text(line, nodes[i])){
+                    err<<"At line "<<lineNo<<" : Couldn't read node "<<i;
+                }
+            }else if(index>=edgesBegin && index<edgesBegin+numChannels){
+                unsigned i=index-edgesBegin;
+                edge_record &e=edges[i];
+                if(!(line.read(e.dstIndex) && line.read(e.srcIndex) && line.read(e.delay) && parse_text(line, e.channel))){
+                    err<<"At line "<<lineNo<<" : Couldn't read node "<<i;
+                }
+            }else{
+                const char *expected = index==0 ? "BeginNodes" : index==nodesBegin+numDevices ? "EndNodes"
+                    : index==edgesBegin-1 ? "BeginEdges" : "EndEdges";
+                line.skip_space();
+                const char *tokenBegin=line.p;
+                while(line.p<line.end && !text_cursor::is_space(*line.p)){
+                    line.p++;
+                }
+                std::string token(tokenBegin, line.p);
+                if(token!=expected){
+                    err<<"At line "<<lineNo<<" : expecting '"<<expected<<"', but got '"<<token<<"'";
+                }
+            }
+            
+            if(err.tellp()>0){
+                c.errorLine=index;
+                c.error=err.str();
+                return;
+            }
+        }
+    });
+    
+    // Report the first error, as if the lines were parsed in order
+    for(unsigned i=0; i<numThreads; i++){
+        if(chunks[i].errorLine!=UINT64_MAX){
+            throw std::runtime_error(chunks[i].error);
+        }
+    }
+    if(totalLines < bodyLines){
+        lineNumber += totalLines+1;
+        std::stringstream err;
+        err<<"Couldn't read line number "<<lineNumber<<"."; 
+        throw std::runtime_error(err.str());
+    }
+    lineNumber += bodyLines;
+    
+    for(unsigned i=0; i<numDevices; i++){
+        dst.addDevice(nodes[i]);
+    }
+    for(unsigned i=0; i<numChannels; i++){
+        const edge_record &e=edges[i];
+        dst.addChannel(e.dstIndex, e.srcIndex, e.delay, e.channel);
     }
-    expect(lineNumber, src, "EndEdges");
 }
 
 #endif
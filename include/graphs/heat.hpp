@@ -3,14 +3,23 @@
 
 #include <vector>
 #include <array>
-#include <unordered_map>
-#include <deque>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <cassert>
 #include <climits>
+#include <cmath>
+#include <algorithm>
 #include <unistd.h>
 #include <iostream>
 
 #include "jpeg_helpers.hpp"
+#include "text_cursor.hpp"
+#include "binary_record.hpp"
+#include "ordered_pipeline.hpp"
+#include "output_format.hpp"
 
 struct heat
 {
@@ -36,6 +45,29 @@ struct heat
         uint32_t time;
         int32_t heat;
     };
+    
+    /* Layout of output_format_raw, which gives the exact heat of every output
+       in each slice. The file starts with a raw_header, then numOutputs
+       raw_output records giving the id and position of each output, in the
+       order they appear in slices. Each slice is then a uint32_t time,
+       followed by numOutputs int32_t heats. All in host byte order. */
+    static const char *raw_magic()
+    { return "PHEATRW1"; }
+    
+    struct raw_header
+    {
+        char magic[8];
+        uint32_t numOutputs;
+        uint32_t outputDelta;   // Slice times are multiples of this
+    };
+    
+    struct raw_output
+    {
+        uint32_t id;
+        uint16_t x, y;
+    };
+    
+    static_assert(sizeof(raw_header)==16 && sizeof(raw_output)==8, "Raw output records must be fixed-width.");
 
     struct channel_type
     {
@@ -108,11 +140,20 @@ struct heat
         // How much does heat from this edge contribute?
         int32_t weightedHeat = mul_fix16(channel->weight, messageIn->heat); 
         
+        accumulate(messageIn->time, weightedHeat, state);
+    }
+    
+    // Second half of on_recv, shared with the batched edge kernels
+    static void accumulate(
+        uint32_t time,
+        int32_t weightedHeat,
+        device_type *state
+    ){
         // Accumulate for this time-step or the next
-        if(messageIn->time == state->time){
+        if(time == state->time){
             state->seenNow += 1;
             state->accNow  += weightedHeat;
-        }else if(messageIn->time == state->time+1){
+        }else if(time == state->time+1){
             state->seenNext += 1;
             state->accNext  += weightedHeat;
         }else{
@@ -164,38 +205,125 @@ struct heat
     private:    
         typedef std::array<uint8_t,3> rgb_colour;
     
-        std::vector<const properties_type *> m_indexToDevice;
-        // Build a map from the device pointer to the index
-        std::unordered_map<const properties_type *, unsigned> m_deviceToIndex;
+        /* What is kept of each output device, in slice order. These are
+           copies, so the simulator is free to drop the full properties
+           once the topology is built. */
+        struct output_device
+        {
+            uint32_t id;
+            uint16_t x, y;
+            int32_t selfWeight;     // Zero is drawn black
+        };
+        std::vector<output_device> m_indexToDevice;
         
         struct time_slice
         {
-            unsigned time;
             unsigned seen;
-            std::vector<int32_t> heat;
+            std::vector<int32_t> heat;  // Empty if no output has arrived for this slice yet
         };
                 
-        // Find the closest output to the given output point
-        unsigned find_closest_device(uint16_t x, uint16_t y)
+        // Index of the closest output to each pixel, built once all nodes are attached
+        std::vector<unsigned> m_pixelToIndex;
+        
+        /* Work out the closest output to every pixel, where ties go to the
+           lowest id. That is the lowest index in files as generated, and
+           unlike the index it survives reordering the file. Outputs are
+           bucketed into a coarse grid with a few per cell, and each pixel
+           searches outwards ring by ring until no closer output could
+           remain, so this is roughly O(pixels) rather than
+           O(pixels*outputs). */
+        void build_closest_map()
         {
-            unsigned closestIndex=0;
-            unsigned closestDistance=UINT_MAX   ;
+            unsigned width=m_graph->width, height=m_graph->height;
+            unsigned n=m_indexToDevice.size();
             
-            for(unsigned i=0; i<m_indexToDevice.size(); i++){
-                int dx = int(x) - m_indexToDevice[i]->x;
-                int dy = int(y) - m_indexToDevice[i]->y;
-                unsigned d = dx*dx + dy*dy;
-                
-                if(d < closestDistance){
-                    closestIndex = i;
-                    closestDistance = d;
+            m_pixelToIndex.assign(width*height, 0);
+            if(n==0)
+                return;
+            
+            unsigned cellSize=std::max(1u, unsigned(std::sqrt(4.0*width*height/n)));
+            int cellsX=(width+cellSize-1)/cellSize, cellsY=(height+cellSize-1)/cellSize;
+            
+            auto cell_of=[&](int v, int cells) -> int
+            { return std::min(cells-1, v/int(cellSize)); };
+            
+            // Outputs in each cell, in index order (CSR layout)
+            std::vector<unsigned> cellBegin(cellsX*cellsY+1, 0);
+            std::vector<unsigned> cellDevices(n);
+            for(unsigned i=0; i<n; i++){
+                int cx=cell_of(m_indexToDevice[i].x, cellsX), cy=cell_of(m_indexToDevice[i].y, cellsY);
+                cellBegin[cy*cellsX+cx+1]++;
+            }
+            for(int c=0; c<cellsX*cellsY; c++){
+                cellBegin[c+1]+=cellBegin[c];
+            }
+            {
+                std::vector<unsigned> fill(cellBegin.begin(), cellBegin.end()-1);
+                for(unsigned i=0; i<n; i++){
+                    int cx=cell_of(m_indexToDevice[i].x, cellsX), cy=cell_of(m_indexToDevice[i].y, cellsY);
+                    cellDevices[fill[cy*cellsX+cx]++]=i;
                 }
             }
             
-            return closestIndex;
+            int maxRing=std::max(cellsX, cellsY);
+            
+            for(unsigned y=0; y<height; y++){
+                int py=cell_of(y, cellsY);
+                for(unsigned x=0; x<width; x++){
+                    int px=cell_of(x, cellsX);
+                    
+                    unsigned closestIndex=UINT_MAX;
+                    unsigned closestId=UINT_MAX;
+                    unsigned closestDistance=UINT_MAX;
+                    
+                    auto visit=[&](int cx, int cy)
+                    {
+                        if(cx<0 || cx>=cellsX || cy<0 || cy>=cellsY)
+                            return;
+                        unsigned c=cy*cellsX+cx;
+                        for(unsigned j=cellBegin[c]; j<cellBegin[c+1]; j++){
+                            unsigned i=cellDevices[j];
+                            int dx = int(x) - m_indexToDevice[i].x;
+                            int dy = int(y) - m_indexToDevice[i].y;
+                            unsigned d = unsigned(dx*dx) + unsigned(dy*dy);
+                            unsigned id = m_indexToDevice[i].id;
+                            if(d < closestDistance || (d==closestDistance && id<closestId)){
+                                closestIndex = i;
+                                closestId = id;
+                                closestDistance = d;
+                            }
+                        }
+                    };
+                    
+                    for(int r=0; r<=maxRing; r++){
+                        if(r==0){
+                            visit(px, py);
+                        }else{
+                            for(int k=-r; k<=r; k++){
+                                visit(px+k, py-r);
+                                visit(px+k, py+r);
+                            }
+                            for(int k=-r+1; k<=r-1; k++){
+                                visit(px-r, py+k);
+                                visit(px+r, py+k);
+                            }
+                        }
+                        // Anything in the next ring is at least r*cellSize+1 away
+                        // along one axis (outputs beyond the image are clamped
+                        // into the edge cells, which only puts them further away)
+                        if(closestIndex!=UINT_MAX){
+                            unsigned bound=r*cellSize+1;
+                            if(bound*bound > closestDistance)
+                                break;
+                        }
+                    }
+                    
+                    m_pixelToIndex[y*width+x]=closestIndex;
+                }
+            }
         }
         
-        rgb_colour choose_colour(const properties_type *device, int32_t heat)
+        rgb_colour choose_colour(const output_device *device, int32_t heat) const
         {
             rgb_colour colour;
             if( device->selfWeight == 0 ){
@@ -219,103 +347,368 @@ struct heat
         }
         
         
+        /* Colour of every heat in [minHeat,maxHeat], as choose_colour gives
+           for a device with non-zero selfWeight. Left empty if the range is
+           too wide to be worth tabulating. */
+        std::vector<rgb_colour> m_colourTable;
+        
+        /* The pixel map as runs of pixels along each row which show the same
+           output, used when the outputs sit on a regular grid (as for rect
+           graphs) and each covers a block of pixels. Rows which are the same
+           as the row above are just copied. */
+        struct pixel_run
+        {
+            uint32_t length;
+            uint32_t index;
+        };
+        bool m_useRuns = false;
+        std::vector<pixel_run> m_runs;
+        std::vector<uint32_t> m_rowRuns;        // Runs of row y are [m_rowRuns[y],m_rowRuns[y+1])
+        std::vector<uint8_t> m_rowRepeats;      // Row y has the same outputs as row y-1
+        
+        void build_render_tables()
+        {
+            build_closest_map();
+            
+            int64_t range=int64_t(m_graph->maxHeat) - m_graph->minHeat + 1;
+            if(range>0 && range<=(1<<22)){
+                output_device lit{0, 0, 0, 1};
+                m_colourTable.resize(range);
+                for(int64_t i=0; i<range; i++){
+                    m_colourTable[i]=choose_colour(&lit, int32_t(m_graph->minHeat+i));
+                }
+            }
+            
+            unsigned width=m_graph->width, height=m_graph->height;
+            m_rowRuns.assign(1, 0);
+            m_rowRepeats.assign(height, 0);
+            for(unsigned y=0; y<height; y++){
+                const unsigned *row=&m_pixelToIndex[y*width];
+                if(y>0 && std::equal(row, row+width, row-width)){
+                    m_rowRepeats[y]=1;
+                }else{
+                    for(unsigned x=0; x<width; x++){
+                        if(x==0 || row[x]!=row[x-1]){
+                            m_runs.push_back(pixel_run{0, row[x]});
+                        }
+                        m_runs.back().length++;
+                    }
+                }
+                m_rowRuns.push_back(m_runs.size());
+            }
+            
+            // Only worth it if runs are fairly long on average
+            m_useRuns = m_runs.size()*4 <= size_t(width)*height;
+            if(m_useRuns){
+                std::vector<unsigned>().swap(m_pixelToIndex);
+            }else{
+                std::vector<pixel_run>().swap(m_runs);
+            }
+        }
+        
+        // Called from the pipeline's worker threads, so only reads the
+        // supervisor. colours is scratch space for the colour of each output.
         void renderSlice(
-            const time_slice &slice
-        ){
+            const std::vector<int32_t> &sliceHeat,
+            std::vector<rgb_colour> &colours,
+            std::vector<uint8_t> &pixels
+        ) const {
             unsigned scanWidth=3*m_graph->width;
             scanWidth= (scanWidth+3)&0xFFFFFFFCul; // pad up to a multiple of four
             
-            std::vector<uint8_t> pixels(scanWidth*m_graph->height);
+            pixels.resize(scanWidth*m_graph->height);
             
-            for(unsigned y=0; y<m_graph->height; y++){
-                for(unsigned x=0; x<m_graph->width; x++){
-                    unsigned deviceIndex = find_closest_device(x,y);
-                    
-                    const properties_type *device = m_indexToDevice[deviceIndex];
-                    int32_t heat = slice.heat[deviceIndex];
-                    rgb_colour colour = choose_colour(device, heat);
-                    
-                    pixels[ y*scanWidth + x*3 + 0 ] = colour[0];
-                    pixels[ y*scanWidth + x*3 + 1 ] = colour[1];
-                    pixels[ y*scanWidth + x*3 + 2 ] = colour[2];
-                    
-                    //fprintf(stderr, " %4.2f (%x%x%x)", heat/65536.0, colour[0]>>4, colour[1]>>4,colour[2]>>4);
+            // Colour each output once, then the pixels just copy them
+            colours.resize(m_indexToDevice.size());
+            for(unsigned i=0; i<m_indexToDevice.size(); i++){
+                if(m_colourTable.empty() || m_indexToDevice[i].selfWeight==0){
+                    colours[i]=choose_colour(&m_indexToDevice[i], sliceHeat[i]);
+                }else{
+                    int32_t heat = std::max(m_graph->minHeat, std::min(m_graph->maxHeat, sliceHeat[i]));
+                    colours[i]=m_colourTable[heat - m_graph->minHeat];
+                }
+            }
+            
+            if(m_useRuns){
+                for(unsigned y=0; y<m_graph->height; y++){
+                    uint8_t *dst=&pixels[y*scanWidth];
+                    if(m_rowRepeats[y]){
+                        std::copy(dst-scanWidth, dst-scanWidth+3*m_graph->width, dst);
+                        continue;
+                    }
+                    for(unsigned r=m_rowRuns[y]; r<m_rowRuns[y+1]; r++){
+                        const rgb_colour &colour=colours[m_runs[r].index];
+                        for(unsigned i=0; i<m_runs[r].length; i++){
+                            dst[0]=colour[0];
+                            dst[1]=colour[1];
+                            dst[2]=colour[2];
+                            dst+=3;
+                        }
+                    }
+                }
+            }else{
+                for(unsigned y=0; y<m_graph->height; y++){
+                    const unsigned *row=&m_pixelToIndex[y*m_graph->width];
+                    uint8_t *dst=&pixels[y*scanWidth];
+                    for(unsigned x=0; x<m_graph->width; x++){
+                        const rgb_colour &colour=colours[row[x]];
+                        dst[3*x+0]=colour[0];
+                        dst[3*x+1]=colour[1];
+                        dst[3*x+2]=colour[2];
+                    }
+                }
+            }
+        }
+        
+        // Render and encode one slice to a JPEG frame, then recycle the buffers
+        void encode_frame(uint32_t time, std::vector<int32_t> &sliceHeat, std::vector<uint8_t> &frame)
+        {
+            if(m_format==output_format_raw){
+                frame.resize(4*(1+sliceHeat.size()));
+                memcpy(&frame[0], &time, 4);
+                if(!sliceHeat.empty()){
+                    memcpy(&frame[4], &sliceHeat[0], 4*sliceHeat.size());
+                }
+                std::unique_lock<std::mutex> lock(m_poolMutex);
+                m_freeHeat.push_back(std::move(sliceHeat));
+                return;
+            }
+            
+            std::vector<uint8_t> pixels;
+            std::vector<rgb_colour> colours;
+            std::unique_ptr<JpegEncoder> encoder;
+            {
+                std::unique_lock<std::mutex> lock(m_poolMutex);
+                if(!m_freePixels.empty()){
+                    pixels.swap(m_freePixels.back());
+                    m_freePixels.pop_back();
+                }
+                if(!m_freeColours.empty()){
+                    colours.swap(m_freeColours.back());
+                    m_freeColours.pop_back();
+                }
+                if(!m_freeEncoders.empty()){
+                    encoder=std::move(m_freeEncoders.back());
+                    m_freeEncoders.pop_back();
+                }
+            }
+            if(!encoder && m_format==output_format_mjpeg){
+                encoder.reset(new JpegEncoder());
+            }
+            
+            renderSlice(sliceHeat, colours, pixels);
+            if(m_format==output_format_mjpeg){
+                encoder->encode(m_graph->width, m_graph->height, pixels, /*quality*/ 100, frame);
+            }else{
+                // Strip the row padding
+                unsigned rowBytes=3*m_graph->width, scanWidth=(rowBytes+3)&0xFFFFFFFCul;
+                frame.resize(size_t(rowBytes)*m_graph->height);
+                for(unsigned y=0; y<m_graph->height; y++){
+                    std::copy(&pixels[y*scanWidth], &pixels[y*scanWidth]+rowBytes, &frame[y*rowBytes]);
                 }
-                //fprintf(stderr, "\n");
             }
-            //fprintf(stderr, "\n\n");
-
             
-            write_JPEG_file (m_graph->width, m_graph->height, pixels, m_destFile, /*quality*/ 100);
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_freeHeat.push_back(std::move(sliceHeat));
+            m_freePixels.push_back(std::move(pixels));
+            m_freeColours.push_back(std::move(colours));
+            if(encoder){
+                m_freeEncoders.push_back(std::move(encoder));
+            }
+        }
+        
+        struct frame_job
+        {
+            SupervisorDevice *supervisor;
+            uint32_t time;
+            std::vector<int32_t> heat;
+            
+            void operator()(std::vector<uint8_t> &frame)
+            { supervisor->encode_frame(time, heat, frame); }
+        };
+        
+        // Start the pipeline, once all nodes are attached, and write any file header
+        void start_output()
+        {
+            if(m_format!=output_format_raw){
+                build_render_tables();
+            }
+            unsigned workers=std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+            m_pipeline.reset(new OrderedPipeline(m_destFile, workers, 2*workers+2));
+            
+            if(m_format==output_format_raw){
+                m_pipeline->submit([this](std::vector<uint8_t> &data){
+                    raw_header header;
+                    memcpy(header.magic, raw_magic(), 8);
+                    header.numOutputs=m_indexToDevice.size();
+                    header.outputDelta=m_graph->outputDelta;
+                    
+                    data.resize(sizeof(header)+sizeof(raw_output)*m_indexToDevice.size());
+                    memcpy(&data[0], &header, sizeof(header));
+                    for(unsigned i=0; i<m_indexToDevice.size(); i++){
+                        raw_output output{ m_indexToDevice[i].id, m_indexToDevice[i].x, m_indexToDevice[i].y };
+                        memcpy(&data[sizeof(header)+i*sizeof(output)], &output, sizeof(output));
+                    }
+                });
+            }
         }
         
         const graph_type *m_graph;  
         FILE *m_destFile;
+        output_format m_format;
         
-        // A deque (double-ended queue) allows us to push and pop from either end
-        std::deque<time_slice> m_slices;
+        /* Slices waiting to be completed, in a ring indexed by slice number
+           (time/outputDelta). Slice m_nextSlice is the next to be written, and
+           the ring grows if an output arrives for a slice too far ahead of it.
+           Heat and pixel buffers of written slices, and JPEG encoders, are
+           kept for re-use. */
+        std::vector<time_slice> m_slices;
+        unsigned m_nextSlice;
+        unsigned m_maxSlices;       // Most slices allowed in progress, or 0 for no limit
+        unsigned m_liveSlices;      // Slices in progress
+        unsigned m_peakSlices;      // Most slices that have been in progress at once
+        std::mutex m_poolMutex;
+        std::vector<std::vector<int32_t> > m_freeHeat;
+        std::vector<std::vector<uint8_t> > m_freePixels;
+        std::vector<std::vector<rgb_colour> > m_freeColours;
+        std::vector<std::unique_ptr<JpegEncoder> > m_freeEncoders;  // One is made for each worker thread
+        
+        /* Completed slices are rendered and encoded by a pool of threads,
+           and written in order, while the simulation carries on. It is
+           started on the first frame, as by then all the nodes are attached
+           and the pixel map can be built. Declared last, so it is drained
+           before anything it uses is destroyed. */
+        std::unique_ptr<OrderedPipeline> m_pipeline;
+        
+        time_slice &get_slice(unsigned sliceNum)
+        {
+            if(sliceNum < m_nextSlice){
+                throw std::runtime_error("heat::SupervisorDevice - output arrived for a slice which has already been written.");
+            }
+            if(sliceNum - m_nextSlice >= m_slices.size()){
+                unsigned size=std::max<size_t>(4, m_slices.size());
+                while(sliceNum - m_nextSlice >= size){
+                    size*=2;
+                }
+                std::vector<time_slice> slices(size);
+                for(unsigned i=0; i<m_slices.size(); i++){
+                    unsigned s=m_nextSlice+i;
+                    slices[s&(size-1)]=std::move(m_slices[s&(m_slices.size()-1)]);
+                }
+                m_slices.swap(slices);
+            }
+            return m_slices[sliceNum&(m_slices.size()-1)];
+        }
     public:
+        /* The output is one of
+           - output_format_mjpeg : each slice rendered as a JPEG, concatenated.
+           - output_format_rgb : each slice rendered as packed 24-bit RGB rows,
+             with no headers, as "ffmpeg -f rawvideo -pix_fmt rgb24" reads.
+           - output_format_raw : the exact heats, laid out as in raw_header.
+           If maxSlices is non-zero, canSend holds back devices whose output
+           would start a slice more than maxSlices-1 past the oldest one still
+           being collected. */
         SupervisorDevice(
             const graph_type *graph,
-            FILE *destFile
+            FILE *destFile,
+            output_format format,
+            unsigned maxSlices
         )
             : m_graph(graph)
             , m_destFile(destFile)
+            , m_format(format)
+            , m_nextSlice(1)    // Devices first output at time outputDelta
+            , m_maxSlices(maxSlices)
+            , m_liveSlices(0)
+            , m_peakSlices(0)
         {}
         
-        void onAttachNode(const properties_type *device)
+        /* Whether a device which is ready to send may do so, which is false if
+           the output it would make goes into a slice beyond the limit. Only
+           reads state which onDeviceOutput changes, so can be called for
+           many devices in parallel between outputs. */
+        bool canSend(const properties_type *device, unsigned devIndex, const device_type *state) const
+        { return canSendAt(devIndex, state->time+1); }  // As on_send will make it
+        
+        // As canSend, for a device whose next message is for the given time
+        bool canSendAt(unsigned devIndex, uint32_t time) const
+        {
+            if(m_maxSlices==0 || devIndex==UINT_MAX)
+                return true;
+            if(time % m_graph->outputDelta)
+                return true;
+            return time/m_graph->outputDelta - m_nextSlice < m_maxSlices;
+        }
+        
+        unsigned peakSlices() const
+        { return m_peakSlices; }
+        
+        // Returns the index of the device in each slice, which the simulator
+        // hands back with each of its outputs
+        unsigned onAttachNode(const properties_type *device)
         {
             if(!device->isOutput)
-                return; // Only track output devices
+                return UINT_MAX; // Only track output devices
             unsigned index=m_indexToDevice.size();
-            m_indexToDevice.push_back(device);
-            m_deviceToIndex[device]=index;
+            m_indexToDevice.push_back(output_device{ device->id, device->x, device->y, device->selfWeight });
+            return index;
         }
         
         void onDeviceOutput(
             const properties_type *device,
+            unsigned devIndex,
             const message_type *message
         ){
             //fprintf(stderr, "On device output %u, %u\n", device->id, message->time);
             
-            unsigned devIndex=m_deviceToIndex.at(device);
-            unsigned sliceIndex=0;
+            assert(devIndex < m_indexToDevice.size());
+            assert(message->time % m_graph->outputDelta == 0);
             
-            //fprintf(stderr, "  Device index = %u\n", devIndex);
-            
-            // Search for the correct destination time slice
-            while(sliceIndex < m_slices.size()){
-                if(message->time == m_slices[sliceIndex].time)
-                    break;
-                sliceIndex++;
-            }
-            // ... or add a new slice if necessary
-            if(sliceIndex == m_slices.size()){
-                // Implication is that this is a new latest time
-                assert( m_slices.size()==0 || (message->time > m_slices.back().time ) );
-                
-                time_slice newSlice;
-                newSlice.time = message->time;
-                newSlice.seen = 0;
-                newSlice.heat.resize( m_indexToDevice.size() ); // Allocate one element per output pixel
+            // The functional engine can deliver outputs out of order, so
+            // there may be several slices in progress.
+            time_slice &slice=get_slice(message->time / m_graph->outputDelta);
+            if(slice.heat.empty()){
+                slice.seen = 0;
+                std::unique_lock<std::mutex> lock(m_poolMutex);
+                if(!m_freeHeat.empty()){
+                    slice.heat.swap(m_freeHeat.back());
+                    m_freeHeat.pop_back();
+                }
+                lock.unlock();
+                slice.heat.resize( m_indexToDevice.size() ); // Allocate one element per output pixel
                 
-                m_slices.push_back(newSlice);
+                m_liveSlices++;
+                m_peakSlices=std::max(m_peakSlices, m_liveSlices);
             }
             
-            
             // Insert the message into the time slice
-            m_slices.at(sliceIndex).heat.at(devIndex) = message->heat;
-            m_slices.at(sliceIndex).seen++; // And record that we have seen another output for this slice
-
-            //fprintf(stderr, "  Slice index = %u, count = %u, target = %u\n", sliceIndex, m_slices.at(sliceIndex).seen, m_indexToDevice.size());
+            slice.heat[devIndex] = message->heat;
+            slice.seen++; // And record that we have seen another output for this slice
             
             // Finally... if we have got the entire next slice, then output it
-            while(! m_slices.empty() && m_slices.front().seen == m_indexToDevice.size() ){
-                //fprintf(stderr, "  Slice full!\n");
-                // Render it and send it down the pipe
-                renderSlice( m_slices.front() );
-                // We are done with it, so remove it
-                m_slices.pop_front();
+            while(1){
+                time_slice &next=m_slices[m_nextSlice&(m_slices.size()-1)];
+                if(next.heat.empty() || next.seen != m_indexToDevice.size())
+                    break;
+                // Send it down the pipe to be rendered, which recycles the buffer
+                if(!m_pipeline){
+                    start_output();
+                }
+                m_pipeline->submit(frame_job{ this, m_nextSlice*m_graph->outputDelta, std::move(next.heat) });
+                next.heat.clear();
+                m_nextSlice++;
+                m_liveSlices--;
+            }
+        }
+        
+        // Wait until all the frames are written
+        void onFinish()
+        {
+            if(!m_pipeline && m_format==output_format_raw){
+                start_output(); // Still needs a header
+            }
+            if(m_pipeline){
+                m_pipeline->finish();
             }
         }
     };
@@ -335,9 +728,50 @@ std::istream &operator>>(std::istream &src, heat::channel_type &c)
 std::ostream &operator<<(std::ostream &dst, const heat::channel_type &c)
 { return dst<<c.weight; }
 
+inline bool parse_text(text_cursor &src, heat::channel_type &c)
+{ return src.read(c.weight); }
+
+inline void write_binary(uint8_t *dst, const heat::channel_type &c)
+{
+    memset(dst, 0, sizeof(c));
+    binary_put(dst, offsetof(heat::channel_type,weight), c.weight);
+}
+
+inline bool read_binary(const uint8_t *src, heat::channel_type &c)
+{ return binary_get(src, offsetof(heat::channel_type,weight), c.weight); }
+
 
 std::istream &operator>>(std::istream &src, heat::properties_type &p)
 { return src>>p.id>>p.neighbourCount>>p.x>>p.y>>p.selfWeight>>p.initValue>>p.isDirichlet>>p.isOutput; }
+
+inline bool parse_text(text_cursor &src, heat::properties_type &p)
+{
+    return src.read(p.id) && src.read(p.neighbourCount) && src.read(p.x) && src.read(p.y)
+        && src.read(p.selfWeight) && src.read(p.initValue) && src.read(p.isDirichlet) && src.read(p.isOutput);
+}
+
+inline void write_binary(uint8_t *dst, const heat::properties_type &p)
+{
+    typedef heat::properties_type T;
+    memset(dst, 0, sizeof(p));
+    binary_put(dst, offsetof(T,id), p.id);
+    binary_put(dst, offsetof(T,neighbourCount), p.neighbourCount);
+    binary_put(dst, offsetof(T,x), p.x);
+    binary_put(dst, offsetof(T,y), p.y);
+    binary_put(dst, offsetof(T,selfWeight), p.selfWeight);
+    binary_put(dst, offsetof(T,initValue), p.initValue);
+    binary_put(dst, offsetof(T,isDirichlet), p.isDirichlet);
+    binary_put(dst, offsetof(T,isOutput), p.isOutput);
+}
+
+inline bool read_binary(const uint8_t *src, heat::properties_type &p)
+{
+    typedef heat::properties_type T;
+    return binary_get(src, offsetof(T,id), p.id) && binary_get(src, offsetof(T,neighbourCount), p.neighbourCount)
+        && binary_get(src, offsetof(T,x), p.x) && binary_get(src, offsetof(T,y), p.y)
+        && binary_get(src, offsetof(T,selfWeight), p.selfWeight) && binary_get(src, offsetof(T,initValue), p.initValue)
+        && binary_get(src, offsetof(T,isDirichlet), p.isDirichlet) && binary_get(src, offsetof(T,isOutput), p.isOutput);
+}
         
 std::ostream &operator<<(std::ostream &src, const heat::properties_type &p)
 { return src<<p.id<<" "<<p.neighbourCount<<" "<<p.x<<" "<<p.y<<" "<<p.selfWeight<<" "<<p.initValue<<" "<<p.isDirichlet<<" "<<p.isOutput; }
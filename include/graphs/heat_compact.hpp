@@ -0,0 +1,258 @@
+#ifndef heat_compact_hpp
+#define heat_compact_hpp
+
+#include "simulator.hpp"
+#include "graphs/heat.hpp"
+
+#include <cstdlib>
+
+/* The heat application with a compact encoding of the state that is touched
+   while stepping, selected with --compact. It reads the same graphs as heat,
+   and gives the same stats and output.
+
+   - A message only needs to say whether it is for the receiver's current
+     time or the next one, so it carries the parity of the time in bit 0 of
+     a 32-bit word, with the heat above it (4 bytes rather than 8).
+   - A Dirichlet device never uses what it accumulates, and other devices
+     only need their heat while sending, so one field holds the heat of the
+     former and the current accumulator of the latter, and the seen counts
+     are 16-bit (16 bytes of state rather than 24).
+   - The properties are split (see hot_properties) into the 12 bytes the
+     handlers read while stepping and the 8 bytes of id and position which
+     only the supervisor and logging read, and the full properties are
+     dropped once the supervisor has taken what it needs from them (20 bytes
+     rather than 24).
+
+   Devices are limited to 65535 inputs, and heats must fit in 31 bits. The
+   latter holds wherever heat's mul_fix16 doesn't overflow, and the initial
+   values and heat range are checked as the graph is loaded.
+*/
+struct heat_compact
+{
+    static const char *type_name()
+    { return "heat"; }
+
+    typedef heat::graph_type graph_type;
+    typedef heat::channel_type channel_type;
+    typedef heat::properties_type properties_type;
+
+    struct hot_properties_type
+    {
+        int32_t selfWeight;
+        int32_t initValue;
+        uint16_t neighbourCount;
+        uint8_t isDirichlet;
+        uint8_t isOutput;
+    };
+
+    struct cold_properties_type
+    {
+        uint32_t id;
+        uint16_t x, y;
+    };
+
+    struct message_type
+    {
+        uint32_t packed;    // Heat in bits 31..1, parity of the time in bit 0
+    };
+
+    struct device_type
+    {
+        uint32_t time;
+        int32_t value;      // Heat if Dirichlet, otherwise the accumulator for this time
+        int32_t accNext;
+        uint16_t seenNow;
+        uint16_t seenNext;
+    };
+
+    static_assert(sizeof(hot_properties_type)==12 && sizeof(cold_properties_type)==8
+        && sizeof(message_type)==4 && sizeof(device_type)==16,
+        "Compact heat types should have no padding.");
+
+    static const int32_t MAX_HEAT=(1<<30)-1;
+
+    static hot_properties_type make_hot(const graph_type *graph, const properties_type &properties)
+    {
+        if(properties.neighbourCount > 0xFFFF){
+            throw std::runtime_error("heat_compact - devices can have at most 65535 inputs.");
+        }
+        if(std::abs(int64_t(properties.initValue)) > MAX_HEAT
+            || std::abs(int64_t(graph->minHeat)) > MAX_HEAT || std::abs(int64_t(graph->maxHeat)) > MAX_HEAT){
+            throw std::runtime_error("heat_compact - heats must fit in 31 bits.");
+        }
+        return hot_properties_type{
+            properties.selfWeight,
+            properties.initValue,
+            uint16_t(properties.neighbourCount),
+            uint8_t(properties.isDirichlet),
+            uint8_t(properties.isOutput)
+        };
+    }
+
+    static cold_properties_type make_cold(const properties_type &properties)
+    { return cold_properties_type{ properties.id, properties.x, properties.y }; }
+
+    static message_type pack(uint32_t time, int32_t heat)
+    {
+        assert( heat >= -MAX_HEAT-1 && heat <= MAX_HEAT );
+        return message_type{ (uint32_t(heat)<<1) | (time&1) };
+    }
+
+    static int32_t unpack_heat(const message_type &message)
+    { return int32_t(message.packed) >> 1; }
+
+    /////////////////////////////////////////////////////////////
+    // Things used during actual execution of devices
+
+    static void on_init(
+        const graph_type *graph,
+        const hot_properties_type *properties,
+        device_type *state
+    ){
+        state->time=0;
+        state->value=properties->initValue;    // The heat, or heat's initial accNow
+        state->accNext=0;
+        state->seenNow=properties->neighbourCount;
+        state->seenNext=0;
+    }
+
+    static bool ready_to_send(
+        const graph_type *graph,
+        const hot_properties_type *properties,
+        const device_type *state
+    ){
+        return (state->time < graph->maxTime)
+            && (state->seenNow == properties->neighbourCount);
+    }
+
+    static void on_recv(
+        const graph_type *graph,
+        const channel_type *channel,
+        const message_type *messageIn,
+        const hot_properties_type *properties,
+        device_type *state
+    ){
+        // Messages are only ever for this time-step or the next
+        bool now = (messageIn->packed & 1) == (state->time & 1);
+        if(properties->isDirichlet){
+            if(now){
+                state->seenNow += 1;
+            }else{
+                state->seenNext += 1;
+            }
+            return;
+        }
+
+        int32_t weightedHeat = heat::mul_fix16(channel->weight, unpack_heat(*messageIn));
+        if(now){
+            state->seenNow += 1;
+            state->value += weightedHeat;
+        }else{
+            state->seenNext += 1;
+            state->accNext += weightedHeat;
+        }
+    }
+
+    static bool on_send(
+        const graph_type *graph,
+        message_type *messageOut,
+        const hot_properties_type *properties,
+        device_type *state
+    ){
+        assert( ready_to_send(graph, properties, state) );
+
+        state->time = state->time+1;
+        int32_t heat;
+        if(properties->isDirichlet){
+            heat = state->value + (properties->initValue>>8);
+            if(heat > graph->maxHeat){
+                heat = graph->minHeat;
+            }else if(heat < graph->minHeat){
+                heat = graph->maxHeat;
+            }
+            state->value = heat;
+        }else{
+            heat = state->value;
+            state->value = state->accNext + heat::mul_fix16(properties->selfWeight, heat);
+        }
+        state->accNext = 0;
+        state->seenNow = state->seenNext;
+        state->seenNext = 0;
+
+        *messageOut = pack(state->time, heat);
+
+        return properties->isOutput && (0 == (state->time % graph->outputDelta));
+    }
+
+
+    /////////////////////////////////////////////////////////////
+    // Used to manage extraction of data from the devices
+
+    /* Wraps heat's supervisor. Outputs no longer say what time they are
+       for, but each output device sends every slice in order, so the
+       supervisor counts them instead. */
+    class SupervisorDevice
+    {
+    private:
+        const graph_type *m_graph;
+        heat::SupervisorDevice m_heat;
+        std::vector<uint32_t> m_outputsSeen;    // Outputs so far from each output device
+
+    public:
+        SupervisorDevice(
+            const graph_type *graph,
+            FILE *destFile,
+            output_format format,
+            unsigned maxSlices
+        )
+            : m_graph(graph)
+            , m_heat(graph, destFile, format, maxSlices)
+        {}
+
+        bool canSend(const cold_properties_type *device, unsigned devIndex, const device_type *state) const
+        { return m_heat.canSendAt(devIndex, state->time+1); }
+
+        unsigned peakSlices() const
+        { return m_heat.peakSlices(); }
+
+        unsigned onAttachNode(const properties_type *device)
+        {
+            unsigned index=m_heat.onAttachNode(device);
+            if(index!=UINT_MAX){
+                m_outputsSeen.resize(index+1, 0);
+            }
+            return index;
+        }
+
+        // heat's supervisor keeps its own copy of what it needs from each
+        // output device, so doesn't look at the device passed to it
+        void onDeviceOutput(
+            const cold_properties_type *device,
+            unsigned devIndex,
+            const message_type *message
+        ){
+            uint32_t slice=++m_outputsSeen[devIndex];
+            heat::message_type full{ slice*m_graph->outputDelta, unpack_heat(*message) };
+            m_heat.onDeviceOutput(nullptr, devIndex, &full);
+        }
+
+        void onFinish()
+        { m_heat.onFinish(); }
+    };
+};
+
+template<>
+struct hot_properties<heat_compact>
+{
+    static const bool available=true;
+    typedef heat_compact::hot_properties_type type;
+    typedef heat_compact::cold_properties_type cold_type;
+
+    static type make(const heat_compact::graph_type *graph, const heat_compact::properties_type &properties)
+    { return heat_compact::make_hot(graph, properties); }
+
+    static cold_type make_cold(const heat_compact::properties_type &properties)
+    { return heat_compact::make_cold(properties); }
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef heat_kernels_hpp
+#define heat_kernels_hpp
+
+#include "simulator.hpp"
+#include "graphs/heat.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEAT_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Batched edge stepping for heat, used by the batch engine. This is exactly
+   step_edge + heat::on_recv, but works through blocks of eight edges with
+   AVX2 where the CPU supports it: the status countdown, the transit/deliver
+   counts and the mul_fix16 weighting are all done across the block, and
+   only the accumulation into the destination devices is scalar. Arithmetic
+   wraps the same way in both paths, so results are bit-identical.
+*/
+template<>
+struct edge_batch_kernel<heat>
+{
+    static const bool available=true;
+
+    static_assert(sizeof(heat::message_type)==8, "Expected message to be {time,heat}.");
+    static_assert(sizeof(heat::channel_type)==4, "Expected channel to be a single weight.");
+
+    static void step(
+        const heat::graph_type *graph,
+        uint32_t begin, uint32_t end,
+        uint32_t *status,
+        const heat::message_type *messages,
+        const heat::channel_type *channels,
+        const uint32_t *dst,
+        const heat::properties_type *properties,
+        heat::device_type *states,
+        uint32_t &idle, uint32_t &transit, uint32_t &deliver
+    ){
+        uint32_t busy=transit+deliver;
+        uint32_t i=begin;
+#ifdef HEAT_KERNELS_X86
+        static const bool haveAVX2=__builtin_cpu_supports("avx2");
+        if(haveAVX2){
+            i=step_avx2(i, end, status, messages, channels, dst, states, transit, deliver);
+        }
+#endif
+        step_scalar(i, end, status, messages, channels, dst, states, transit, deliver);
+
+        idle += (end-begin) - (transit+deliver-busy);
+    }
+
+private:
+    static void step_scalar(
+        uint32_t begin, uint32_t end,
+        uint32_t *status,
+        const heat::message_type *messages,
+        const heat::channel_type *channels,
+        const uint32_t *dst,
+        heat::device_type *states,
+        uint32_t &transit, uint32_t &deliver
+    ){
+        for(uint32_t i=begin; i<end; i++){
+            uint32_t s=status[i];
+            if(s > 1){
+                status[i]=s-1;
+                transit++;
+            }else if(s == 1){
+                status[i]=0;
+                deliver++;
+                int32_t weightedHeat=heat::mul_fix16(channels[i].weight, messages[i].heat);
+                heat::accumulate(messages[i].time, weightedHeat, &states[dst[i]]);
+            }
+        }
+    }
+
+#ifdef HEAT_KERNELS_X86
+    // Returns the first edge that wasn't processed (the tail of less than eight)
+    __attribute__((target("avx2,popcnt")))
+    static uint32_t step_avx2(
+        uint32_t begin, uint32_t end,
+        uint32_t *status,
+        const heat::message_type *messages,
+        const heat::channel_type *channels,
+        const uint32_t *dst,
+        heat::device_type *states,
+        uint32_t &transit, uint32_t &deliver
+    ){
+        const __m256i zero=_mm256_setzero_si256();
+        const __m256i one=_mm256_set1_epi32(1);
+        const __m256i half=_mm256_set1_epi32(0x8000);
+
+        uint32_t i=begin;
+        for(; i+8<=end; i+=8){
+            __m256i s=_mm256_loadu_si256((const __m256i*)(status+i));
+            __m256i busy=_mm256_cmpgt_epi32(s, zero);  // Statuses are small, so signed compare is fine
+            __m256i arriving=_mm256_cmpeq_epi32(s, one);
+
+            unsigned busyMask=_mm256_movemask_ps(_mm256_castsi256_ps(busy));
+            unsigned arrivingMask=_mm256_movemask_ps(_mm256_castsi256_ps(arriving));
+            if(!busyMask)
+                continue;
+
+            transit += _mm_popcnt_u32(busyMask & ~arrivingMask);
+            deliver += _mm_popcnt_u32(arrivingMask);
+
+            // Busy lanes count down by one, so arriving lanes become empty
+            _mm256_storeu_si256((__m256i*)(status+i), _mm256_add_epi32(s, busy));
+
+            if(!arrivingMask)
+                continue;
+
+            // De-interleave the heat fields of the eight {time,heat} messages
+            __m256 lo=_mm256_loadu_ps((const float*)(messages+i));
+            __m256 hi=_mm256_loadu_ps((const float*)(messages+i+4));
+            __m256i heats=_mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
+            heats=_mm256_permute4x64_epi64(heats, _MM_SHUFFLE(3,1,2,0));
+
+            // mul_fix16 across the block
+            __m256i weights=_mm256_loadu_si256((const __m256i*)(channels+i));
+            __m256i weighted=_mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(weights, heats), half), 16);
+
+            int32_t weightedHeat[8];
+            _mm256_storeu_si256((__m256i*)weightedHeat, weighted);
+
+            while(arrivingMask){
+                unsigned lane=__builtin_ctz(arrivingMask);
+                arrivingMask &= arrivingMask-1;
+                heat::accumulate(messages[i+lane].time, weightedHeat[lane], &states[dst[i+lane]]);
+            }
+        }
+        return i;
+    }
+#endif
+};
+
+#endif
@@ -10,6 +10,10 @@
 #include <unistd.h>
 #include <iostream>
 
+#include "text_cursor.hpp"
+#include "binary_record.hpp"
+#include "output_format.hpp"
+
 struct ring
 {
     static const char *type_name()
@@ -91,25 +95,44 @@ struct ring
         FILE *m_destFile;
         
     public:
+        // Output is always text, whatever the format, and never held back
         SupervisorDevice(
             const graph_type *graph,
-            FILE *destFile
+            FILE *destFile,
+            output_format format,
+            unsigned maxSlices
         )
             : m_graph(graph)
             , m_destFile(destFile)
         {}
         
-        void onAttachNode(const properties_type *device)
+        unsigned onAttachNode(const properties_type *device)
         {
-            // do nothing
+            return 0; // do nothing
+        }
+        
+        bool canSend(const properties_type *device, unsigned tag, const device_type *state) const
+        {
+            return true;
+        }
+        
+        unsigned peakSlices() const
+        {
+            return 0;
         }
         
         void onDeviceOutput(
             const properties_type *device,
+            unsigned tag,
             const message_type *message
         ){
             fprintf(m_destFile, "Tick : %u\n", device->id);
         }
+        
+        void onFinish()
+        {
+            // do nothing
+        }
     };
 };
 
@@ -127,9 +150,31 @@ std::istream &operator>>(std::istream &src, ring::channel_type &c)
 std::ostream &operator<<(std::ostream &dst, const ring::channel_type &c)
 { return dst; }
 
+inline bool parse_text(text_cursor &src, ring::channel_type &c)
+{ return true; }
+
+inline void write_binary(uint8_t *dst, const ring::channel_type &c)
+{ memset(dst, 0, sizeof(c)); }
+
+inline bool read_binary(const uint8_t *src, ring::channel_type &c)
+{ return true; }
+
 
 std::istream &operator>>(std::istream &src, ring::properties_type &p)
 { return src>>p.id>>p.initial; }
+
+inline bool parse_text(text_cursor &src, ring::properties_type &p)
+{ return src.read(p.id) && src.read(p.initial); }
+
+inline void write_binary(uint8_t *dst, const ring::properties_type &p)
+{
+    memset(dst, 0, sizeof(p));
+    binary_put(dst, offsetof(ring::properties_type,id), p.id);
+    binary_put(dst, offsetof(ring::properties_type,initial), p.initial);
+}
+
+inline bool read_binary(const uint8_t *src, ring::properties_type &p)
+{ return binary_get(src, offsetof(ring::properties_type,id), p.id) && binary_get(src, offsetof(ring::properties_type,initial), p.initial); }
         
 std::ostream &operator<<(std::ostream &src, const ring::properties_type &p)
 { return src<<p.id<<" "<<p.initial; }
@@ -0,0 +1,215 @@
+#ifndef gzip_stream_hpp
+#define gzip_stream_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <zlib.h>
+
+/* An input stream which decompresses a gzip stream read from another stream.
+   Decompression runs on its own thread, a few chunks ahead of the reader, so
+   parsing overlaps with inflating and the uncompressed data never has to
+   exist as a whole. Concatenated gzip members are read one after another,
+   as gunzip does.
+
+   Errors in the compressed data are thrown from the reading operation that
+   hits them, as this stream has badbit exceptions enabled. */
+class GzipInputStream
+    : public std::istream
+{
+private:
+    class decompress_buffer
+        : public std::streambuf
+    {
+    private:
+        static const size_t CHUNK_SIZE=1<<20;
+        static const size_t MAX_CHUNKS=4;   // Decompressed chunks the thread can get ahead by
+
+        std::istream &m_src;
+
+        std::mutex m_mutex;
+        std::condition_variable m_ready;    // Signalled when a chunk is queued, or the thread finishes
+        std::condition_variable m_space;    // Signalled when a chunk is consumed, or on shutdown
+        std::deque<std::vector<char> > m_full;
+        std::vector<std::vector<char> > m_free;
+        bool m_finished;
+        bool m_quit;
+        std::string m_error;
+
+        std::vector<char> m_current;        // Chunk being read through the get area
+
+        std::thread m_thread;
+
+        // Hand a filled chunk to the reader, returning false if it has gone away
+        bool push_chunk(std::vector<char> &chunk)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_space.wait(lock, [&](){ return m_quit || m_full.size()<MAX_CHUNKS; });
+            if(m_quit)
+                return false;
+            m_full.push_back(std::move(chunk));
+            if(!m_free.empty()){
+                chunk=std::move(m_free.back());
+                m_free.pop_back();
+            }else{
+                chunk=std::vector<char>();
+            }
+            m_ready.notify_one();
+            return true;
+        }
+
+        void finish(const std::string &error)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished=true;
+            m_error=error;
+            m_ready.notify_one();
+        }
+
+        void decompress()
+        {
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            if(inflateInit2(&zs, 15+16) != Z_OK){   // 15+16 : gzip wrapper only
+                finish("GzipInputStream - couldn't initialise zlib.");
+                return;
+            }
+
+            std::vector<char> in(CHUNK_SIZE/4);
+            std::vector<char> out;
+            size_t used=0;
+            bool inMember=false;
+            std::string error;
+
+            while(1){
+                if(zs.avail_in==0){
+                    m_src.read(&in[0], in.size());
+                    zs.next_in=(Bytef*)&in[0];
+                    zs.avail_in=m_src.gcount();
+                    if(zs.avail_in==0){
+                        if(inMember){
+                            error="GzipInputStream - compressed stream is truncated.";
+                        }
+                        break;
+                    }
+                }
+
+                if(out.size()!=CHUNK_SIZE){
+                    out.resize(CHUNK_SIZE);
+                }
+                zs.next_out=(Bytef*)&out[used];
+                zs.avail_out=CHUNK_SIZE-used;
+
+                inMember=true;
+                int code=inflate(&zs, Z_NO_FLUSH);
+                used=CHUNK_SIZE-zs.avail_out;
+
+                if(code==Z_STREAM_END){
+                    // Another member may follow
+                    inflateReset(&zs);
+                    inMember=false;
+                }else if(code!=Z_OK && code!=Z_BUF_ERROR){
+                    error=std::string("GzipInputStream - corrupt compressed data (")+(zs.msg ? zs.msg : "unknown error")+").";
+                    break;
+                }
+
+                if(used==CHUNK_SIZE){
+                    if(!push_chunk(out)){
+                        inflateEnd(&zs);
+                        return;
+                    }
+                    used=0;
+                }
+            }
+            inflateEnd(&zs);
+
+            if(used>0 && error.empty()){
+                out.resize(used);
+                if(!push_chunk(out))
+                    return;
+            }
+            finish(error);
+        }
+
+    protected:
+        int_type underflow() override
+        {
+            if(gptr() < egptr())
+                return traits_type::to_int_type(*gptr());
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(!m_current.empty()){
+                m_free.push_back(std::move(m_current));
+                m_current.clear();
+            }
+            m_ready.wait(lock, [&](){ return m_finished || !m_full.empty(); });
+            if(m_full.empty()){
+                if(!m_error.empty()){
+                    throw std::runtime_error(m_error);
+                }
+                return traits_type::eof();
+            }
+            m_current=std::move(m_full.front());
+            m_full.pop_front();
+            m_space.notify_one();
+            lock.unlock();
+
+            setg(&m_current[0], &m_current[0], &m_current[0]+m_current.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+    public:
+        decompress_buffer(std::istream &src)
+            : m_src(src)
+            , m_finished(false)
+            , m_quit(false)
+        {
+            m_thread=std::thread([this](){ decompress(); });
+        }
+
+        ~decompress_buffer()
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_quit=true;
+            }
+            m_space.notify_all();
+            m_thread.join();
+        }
+    };
+
+    decompress_buffer m_buffer;
+
+public:
+    GzipInputStream(std::istream &src)
+        : std::istream(0)
+        , m_buffer(src)
+    {
+        rdbuf(&m_buffer);
+        exceptions(std::ios_base::badbit);
+    }
+};
+
+// Checks whether the next thing in the stream is gzip compressed
+inline bool stream_is_gzip(std::istream &src)
+{
+    if(src.peek()!=0x1f)
+        return false;
+    // Need the second magic byte too, without consuming anything
+    std::streambuf *buf=src.rdbuf();
+    if(buf->sbumpc()!=0x1f)
+        return false;
+    int second=buf->sgetc();
+    buf->sungetc();
+    return second==0x8b;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef index_bitmap_hpp
+#define index_bitmap_hpp
+
+#include <cstdint>
+#include <vector>
+
+/* A set of indices in [0,size), which is emptied by visiting its members in
+   ascending order. Inserting is a couple of bit operations, and a second
+   level of bits marks the non-zero words, so draining costs about size/4096
+   word reads plus the members, rather than a sort.
+
+   Used by the active engine to visit nodes and edges in index order without
+   sorting them on every step. */
+class IndexBitmap
+{
+private:
+    std::vector<uint64_t> m_words;      // Bit i&63 of word i>>6 is set if i is present
+    std::vector<uint64_t> m_summary;    // Bit w&63 of word w>>6 is set if word w may be non-zero
+    uint32_t m_count;
+public:
+    IndexBitmap()
+        : m_count(0)
+    {}
+
+    // Empty the set, and allow indices in [0,size)
+    void reset(uint32_t size)
+    {
+        m_words.assign((uint64_t(size)+63)/64, 0);
+        m_summary.assign((m_words.size()+63)/64, 0);
+        m_count=0;
+    }
+
+    uint32_t count() const
+    { return m_count; }
+
+    bool empty() const
+    { return m_count==0; }
+
+    // Returns false if the index was already present
+    bool insert(uint32_t index)
+    {
+        uint64_t &word=m_words[index>>6];
+        uint64_t bit=uint64_t(1)<<(index&63);
+        if(word & bit)
+            return false;
+        word |= bit;
+        m_summary[index>>12] |= uint64_t(1)<<((index>>6)&63);
+        m_count++;
+        return true;
+    }
+
+    // Call f(index) for every member in ascending order, leaving the set
+    // empty. f must not insert into this set.
+    template<class TFunc>
+    void drain(TFunc f)
+    {
+        for(uint32_t s=0; s<m_summary.size() && m_count; s++){
+            uint64_t summary=m_summary[s];
+            m_summary[s]=0;
+            while(summary){
+                uint32_t w=s*64+__builtin_ctzll(summary);
+                summary &= summary-1;
+                uint64_t word=m_words[w];
+                m_words[w]=0;
+                m_count -= __builtin_popcountll(word);
+                while(word){
+                    f(w*64+__builtin_ctzll(word));
+                    word &= word-1;
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -8,6 +8,11 @@
 
 #include <setjmp.h>
 
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
 // Credit to: https://github.com/LuaDist/libjpeg/blob/master/example.c
 
 /*
@@ -295,4 +300,123 @@ void write_JPEG_file (unsigned width, unsigned height, const std::vector<uint8_t
   fflush(outfile);
 }
 
+/* Encodes a sequence of frames into memory, keeping one compression object
+   (and its working memory) across frames rather than building a new one for
+   each, and handing the library all the scanlines in one call. The settings
+   are only redone when the frame size or quality changes, so the output is
+   the same as write_JPEG_file gives. Errors from the library are thrown as
+   std::runtime_error. An encoder must only be used by one thread at a time. */
+class JpegEncoder
+{
+private:
+    struct vector_dest
+    {
+        struct jpeg_destination_mgr pub;    // Must be first
+        std::vector<uint8_t> *out;
+    };
+    
+    static void init_destination(j_compress_ptr cinfo)
+    {
+        vector_dest *dest=(vector_dest*)cinfo->dest;
+        dest->out->resize(std::max<size_t>(dest->out->capacity(), 1<<16));
+        dest->pub.next_output_byte=&(*dest->out)[0];
+        dest->pub.free_in_buffer=dest->out->size();
+    }
+    
+    static boolean empty_output_buffer(j_compress_ptr cinfo)
+    {
+        // Called when the whole buffer is full, which is what libjpeg expects us to write
+        vector_dest *dest=(vector_dest*)cinfo->dest;
+        size_t used=dest->out->size();
+        dest->out->resize(2*used);
+        dest->pub.next_output_byte=&(*dest->out)[used];
+        dest->pub.free_in_buffer=dest->out->size()-used;
+        return TRUE;
+    }
+    
+    static void term_destination(j_compress_ptr cinfo)
+    {
+        vector_dest *dest=(vector_dest*)cinfo->dest;
+        dest->out->resize(dest->out->size()-dest->pub.free_in_buffer);
+    }
+    
+    struct jpeg_compress_struct m_cinfo;
+    struct my_error_mgr m_jerr;
+    vector_dest m_dest;
+    
+    unsigned m_width, m_height;
+    int m_quality;
+    std::vector<JSAMPROW> m_rows;
+    
+    JpegEncoder(const JpegEncoder &); // = delete
+    JpegEncoder &operator=(const JpegEncoder &); // = delete
+public:
+    JpegEncoder()
+        : m_width(0)
+        , m_height(0)
+        , m_quality(-1)
+    {
+        m_cinfo.err = jpeg_std_error(&m_jerr.pub);
+        m_jerr.pub.error_exit = my_error_exit;
+        if(setjmp(m_jerr.setjmp_buffer)){
+            jpeg_destroy_compress(&m_cinfo);
+            throw std::runtime_error("JpegEncoder - couldn't create compressor.");
+        }
+        jpeg_create_compress(&m_cinfo);
+        
+        m_dest.pub.init_destination=init_destination;
+        m_dest.pub.empty_output_buffer=empty_output_buffer;
+        m_dest.pub.term_destination=term_destination;
+        m_dest.out=0;
+        m_cinfo.dest=&m_dest.pub;
+    }
+    
+    ~JpegEncoder()
+    {
+        m_cinfo.dest=0; // Not allocated by the library
+        jpeg_destroy_compress(&m_cinfo);
+    }
+    
+    /* Replace dst with the JPEG for the image in pixels, which is RGB with
+       rows padded to a multiple of four bytes (as write_JPEG_file takes). */
+    void encode(unsigned width, unsigned height, const std::vector<uint8_t> &pixels, int quality, std::vector<uint8_t> &dst)
+    {
+        unsigned rowStride=((width*3+3)/4)*4;
+        if(pixels.size() < size_t(rowStride)*height){
+            throw std::runtime_error("JpegEncoder - pixel buffer is too small for the image.");
+        }
+        
+        if(setjmp(m_jerr.setjmp_buffer)){
+            jpeg_abort_compress(&m_cinfo);
+            m_quality=-1;   // Start from scratch next time
+            throw std::runtime_error("JpegEncoder - couldn't encode frame.");
+        }
+        
+        if(width!=m_width || height!=m_height || quality!=m_quality){
+            m_cinfo.image_width = width;
+            m_cinfo.image_height = height;
+            m_cinfo.input_components = 3;
+            m_cinfo.in_color_space = JCS_RGB;
+            jpeg_set_defaults(&m_cinfo);
+            jpeg_set_quality(&m_cinfo, quality, TRUE /* limit to baseline-JPEG values */);
+            m_width=width;
+            m_height=height;
+            m_quality=quality;
+        }
+        
+        m_rows.resize(height);
+        for(unsigned y=0; y<height; y++){
+            m_rows[y]=(JSAMPROW)&pixels[y*rowStride];
+        }
+        
+        m_dest.out=&dst;
+        jpeg_start_compress(&m_cinfo, TRUE);
+        while(m_cinfo.next_scanline < m_cinfo.image_height){
+            jpeg_write_scanlines(&m_cinfo, &m_rows[m_cinfo.next_scanline], m_cinfo.image_height-m_cinfo.next_scanline);
+        }
+        jpeg_finish_compress(&m_cinfo);
+        m_dest.out=0;
+    }
+};
+
 #endif
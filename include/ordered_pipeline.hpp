@@ -0,0 +1,180 @@
+#ifndef ordered_pipeline_hpp
+#define ordered_pipeline_hpp
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* Runs jobs which each produce a block of bytes on a pool of worker threads,
+   while a writer thread appends the blocks to a file in the order the jobs
+   were submitted. At most maxInFlight jobs can be queued, running or waiting
+   to be written, and submit blocks until there is room, so a slow file or
+   slow jobs hold back the producer rather than using unbounded memory.
+
+   Used by supervisors to render and encode frames off the simulation thread.
+   Exceptions from jobs, and write failures, are rethrown by the next submit
+   or by finish. */
+class OrderedPipeline
+{
+public:
+    typedef std::function<void(std::vector<uint8_t> &)> job_type;
+
+private:
+    struct slot
+    {
+        bool ready;
+        std::vector<uint8_t> data;
+    };
+
+    FILE *m_dst;
+    unsigned m_maxInFlight;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;     // Signalled when a job is queued, or on shutdown
+    std::condition_variable m_slotReady;    // Signalled when a job completes, or on shutdown
+    std::condition_variable m_space;        // Signalled when a block is written, or on failure
+    std::deque<std::pair<uint64_t,job_type> > m_jobs;
+    std::vector<slot> m_slots;              // Results, indexed by job number % maxInFlight
+    uint64_t m_submitted;
+    uint64_t m_written;
+    bool m_quit;
+    std::string m_error;
+
+    std::vector<std::thread> m_workers;
+    std::thread m_writer;
+
+    void fail(const std::string &error)
+    {
+        if(m_error.empty()){
+            m_error=error;
+        }
+        m_space.notify_all();
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(1){
+            m_jobReady.wait(lock, [&](){ return m_quit || !m_jobs.empty(); });
+            if(m_jobs.empty())
+                return;
+            uint64_t index=m_jobs.front().first;
+            job_type job=std::move(m_jobs.front().second);
+            m_jobs.pop_front();
+
+            std::vector<uint8_t> data(std::move(m_slots[index%m_maxInFlight].data));
+            lock.unlock();
+            data.clear();
+            std::string error;
+            try{
+                job(data);
+            }catch(std::exception &e){
+                error=e.what();
+            }
+            lock.lock();
+
+            if(!error.empty()){
+                fail(error);
+            }
+            m_slots[index%m_maxInFlight].data=std::move(data);
+            m_slots[index%m_maxInFlight].ready=true;
+            m_slotReady.notify_all();
+        }
+    }
+
+    void writer()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(1){
+            slot &next=m_slots[m_written%m_maxInFlight];
+            m_slotReady.wait(lock, [&](){ return next.ready || (m_quit && m_written==m_submitted); });
+            if(!next.ready)
+                return;
+            // Once something has failed, later blocks are dropped
+            bool skip=!m_error.empty();
+            lock.unlock();
+            bool ok = skip || next.data.empty() || fwrite(&next.data[0], 1, next.data.size(), m_dst)==next.data.size();
+            ok = ok && fflush(m_dst)==0;
+            lock.lock();
+
+            if(!ok){
+                fail("OrderedPipeline - couldn't write to output file.");
+            }
+            next.ready=false;
+            m_written++;
+            m_space.notify_all();
+        }
+    }
+
+    void check_error()
+    {
+        if(!m_error.empty()){
+            throw std::runtime_error(m_error);
+        }
+    }
+
+    void shutdown()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_quit)
+                return;
+            m_quit=true;
+        }
+        m_jobReady.notify_all();
+        m_slotReady.notify_all();
+        for(unsigned i=0; i<m_workers.size(); i++){
+            m_workers[i].join();
+        }
+        m_writer.join();
+    }
+public:
+    OrderedPipeline(FILE *dst, unsigned workers, unsigned maxInFlight)
+        : m_dst(dst)
+        , m_maxInFlight(std::max(1u, maxInFlight))
+        , m_slots(m_maxInFlight)
+        , m_submitted(0)
+        , m_written(0)
+        , m_quit(false)
+    {
+        for(unsigned i=0; i<m_maxInFlight; i++){
+            m_slots[i].ready=false;
+        }
+        for(unsigned i=0; i<std::max(1u, workers); i++){
+            m_workers.push_back(std::thread([this](){ worker(); }));
+        }
+        m_writer=std::thread([this](){ writer(); });
+    }
+
+    ~OrderedPipeline()
+    {
+        shutdown();
+    }
+
+    void submit(job_type job)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock, [&](){ return !m_error.empty() || m_submitted-m_written < m_maxInFlight; });
+        check_error();
+        m_jobs.push_back(std::make_pair(m_submitted, std::move(job)));
+        m_submitted++;
+        m_jobReady.notify_one();
+    }
+
+    // Wait for everything submitted to be written, and stop the threads
+    void finish()
+    {
+        shutdown();
+        check_error();
+    }
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef output_format_hpp
+#define output_format_hpp
+
+/* What a supervisor writes to the output file, chosen with --output-format.
+   Each graph type documents what these mean for it (see heat::SupervisorDevice),
+   and graph types with only one kind of output ignore this. */
+enum output_format
+{
+    output_format_mjpeg,    // Rendered frames as concatenated JPEGs (the default)
+    output_format_raw,      // Exact output values
+    output_format_rgb       // Rendered frames as uncompressed 24-bit RGB
+};
+
+#endif
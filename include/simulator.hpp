@@ -8,9 +8,91 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream> 
+#include <algorithm>
+#include <memory>
+#include <type_traits>
 #include <stdarg.h>
 
 #include "util.hpp"
+#include "thread_team.hpp"
+#include "index_bitmap.hpp"
+#include "graph_reorder.hpp"
+#include "stats_writer.hpp"
+#include "output_format.hpp"
+
+/* Highest log level that is compiled in. Calls to log<level> above this are
+   removed entirely, along with the evaluation of their arguments, so release
+   builds can drop the per-node and per-edge tracing (levels 3 and 4) from the
+   inner loops. --log-level can still lower the level at run-time. */
+#ifndef SIMULATOR_MAX_LOG_LEVEL
+#define SIMULATOR_MAX_LOG_LEVEL 4
+#endif
+
+struct simulator_options
+{
+    enum engine_type
+    {
+        engine_scan,    // Visit every edge and node on every step (reference behaviour)
+        engine_active,  // Only visit edges holding a message and nodes whose inputs changed
+        engine_batch,   // As scan, but edges are stepped by the graph's edge_batch_kernel
+        engine_functional   // Ignore the network, and deliver messages as soon as they are sent
+    };
+    
+    engine_type engine = engine_scan;
+    
+    // Number of threads used to step the scan and batch engines. The nodes are split
+    // into contiguous ranges, and each thread steps the incoming edges and
+    // then the nodes of its range, so results don't depend on thread count.
+    unsigned threads = 1;
+    
+    enum reorder_type
+    {
+        reorder_none,   // Keep nodes in the order they were loaded
+        reorder_rcm     // Reverse Cuthill-McKee, to place neighbours close in memory
+    };
+    
+    // Storage order of nodes. This only affects performance, as the supervisor
+    // still sees devices and outputs in load order.
+    reorder_type reorder = reorder_none;
+    
+    // Encoding of the stats stream
+    StatsWriter::format_type statsFormat = StatsWriter::format_text;
+    
+    // What the supervisor writes to the output file
+    output_format outputFormat = output_format_mjpeg;
+    
+    // Most output slices the supervisor may be collecting at once (0 for no
+    // limit). Devices whose next output would need another one are held
+    // back, and count as blocked, so this can change the stats.
+    unsigned maxSlices = 0;
+};
+
+/* Hook that lets a graph type step a contiguous range of edges in one go,
+   instead of calling on_recv for each delivery. The edges in the range are
+   sorted by destination. Graph types provide one by specialising this with
+   available=true and a static step function (see graphs/heat_kernels.hpp);
+   without one the batch engine behaves exactly like the scan engine. */
+template<class TGraph>
+struct edge_batch_kernel
+{
+    static const bool available=false;
+};
+
+/* Hook that lets a graph type split each device's properties into a hot
+   part, holding just the fields the device handlers read while stepping, and
+   a cold part, which canSend, onDeviceOutput and logging see. The supervisor
+   is attached to the full properties, which are then released, so each field
+   is only stored once. Graph types provide one by specialising this with
+   available=true, the two types, and static make and make_cold functions
+   (see graphs/heat_compact.hpp); without one everything sees the full
+   properties. */
+template<class TGraph>
+struct hot_properties
+{
+    static const bool available=false;
+    typedef typename TGraph::properties_type type;
+    typedef typename TGraph::properties_type cold_type;
+};
 
 template<class TGraph>
 class Simulator
@@ -22,119 +104,203 @@ public:
     typedef typename TGraph::message_type message_type;
     typedef typename TGraph::channel_type channel_type;
     typedef typename TGraph::SupervisorDevice SupervisorDevice;
+    typedef typename hot_properties<TGraph>::type hot_properties_type;
+    typedef typename hot_properties<TGraph>::cold_type cold_properties_type;
 private:    
-    struct node;
-    struct edge;
     struct output;
-
-    struct node
-    {
-        properties_type properties;
-        device_type state;
-        std::vector<edge*> incoming;
-        std::vector<edge*> outgoing;
-    };
-    
-    struct edge
-    {
-        node *dst;
-        node *src;
-        unsigned delay;         // How long it takes a message to get through
-        
-        channel_type channel;
-        
-        unsigned messageStatus; // 0->empty, 1->ready, 2->inflight
-        message_type messageData;
-    };
     
     struct output
     {
-        const properties_type *source;  // Where the output came from
+        const cold_properties_type *source; // Where the output came from
+        uint32_t sourceOrder;           // Load order of the source device
+        uint32_t supervisorTag;         // What the supervisor returned when the source was attached
         message_type output;            // Message associated with the output
         unsigned sendStep;              // Which step was it send in?
     };
     
-    struct stats
+    typedef step_stats stats;
+    
+    // Work partition used when stepping with multiple threads
+    struct worker
     {
-        uint32_t stepIndex;
-        
-        uint32_t nodeIdleSteps;
-        uint32_t nodeBlockedSteps;
-        uint32_t nodeSendSteps;
-        
-        uint32_t edgeIdleSteps;
-        uint32_t edgeTransitSteps;
-        uint32_t edgeDeliverSteps;
+        uint32_t nodeBegin, nodeEnd;    // Owns nodes [nodeBegin,nodeEnd) and their incoming edges
+        stats counts;
+        std::deque<output> outputs;
     };
     
     int m_logLevel;
+    simulator_options m_options;
     
-    void log(int level, const char *msg, ...)
+    template<int level, class ...TArgs>
+    void log(const char *msg, TArgs ...args)
     {
-        if(level <= m_logLevel){
-            char localBuffer[256];
-            char *globalBuffer=0;
-            char *buffer=localBuffer;
-            
+        if(level <= SIMULATOR_MAX_LOG_LEVEL && level <= m_logLevel){
+            log_message(level, msg, args...);
+        }
+    }
+    
+    void log_message(int level, const char *msg, ...)
+    {
+        char localBuffer[256];
+        char *globalBuffer=0;
+        char *buffer=localBuffer;
+        
+        va_list va;
+        va_start(va, msg);
+        int n=vsnprintf(buffer, sizeof(localBuffer), msg, va);
+        va_end(va);
+        
+        if(n<=0){
+            throw std::runtime_error("log failure.");
+        }
+        
+        if(n >= (int)sizeof(localBuffer)){
+            globalBuffer=new char[n+1];
+            buffer=globalBuffer;
             va_list va;
             va_start(va, msg);
-            int n=vsnprintf(buffer, sizeof(localBuffer), msg, va);
+            vsnprintf(buffer, n+1, msg, va);
             va_end(va);
-            
-            if(n<=0){
-                throw std::runtime_error("log failure.");
-            }
-            
-            if(n >= (int)sizeof(localBuffer)){
-                globalBuffer=new char[n+1];
-                buffer=globalBuffer;
-                va_list va;
-                va_start(va, msg);
-                vsnprintf(buffer, n+1, msg, va);
-                va_end(va);
-            }
-            
-            
-            
-            fprintf(stderr, "[Sim], %u, %.3f, %s\n", level, puzzler::now()*1e-9, buffer);
-            
-            if(globalBuffer){
-                delete []globalBuffer;
-            }
+        }
+        
+        
+        
+        fprintf(stderr, "[Sim], %u, %.3f, %s\n", level, puzzler::now()*1e-9, buffer);
+        
+        if(globalBuffer){
+            delete []globalBuffer;
         }
     }
     
     uint32_t m_step;
     graph_type m_graph;
-    std::vector<node> m_nodes;
-    std::vector<edge> m_edges;
+    
+    /* Graph storage is split into structure-of-arrays, with 32-bit indices.
+       Edges are appended in load order, then once loading is finished they are
+       (stably) sorted by destination in build_topology, so the incoming edges
+       of each node are a contiguous range and each node still sees its inputs
+       in load order. The outgoing edges of each node are a compressed-sparse-row
+       list of edge indices. */
+    
+    // Nodes : cold
+    std::vector<properties_type> m_properties;          // As loaded. Emptied once built if the graph has hot_properties
+    std::vector<cold_properties_type> m_coldProperties; // Empty unless the graph has hot_properties
+    // Nodes : hot
+    std::vector<hot_properties_type> m_hotProperties;  // Empty unless the graph has hot_properties
+    std::vector<device_type> m_state;
+    
+    // Edges : cold
+    std::vector<uint32_t> m_edgeSrc;
+    std::vector<uint32_t> m_edgeDst;
+    std::vector<uint32_t> m_edgeDelay;      // How long it takes a message to get through
+    std::vector<channel_type> m_edgeChannel;
+    // Edges : hot
+    std::vector<uint32_t> m_edgeStatus;     // 0->empty, 1->ready, 2->inflight
+    std::vector<message_type> m_edgeMessage;
+    
+    // Topology, built once after loading
+    bool m_topologyBuilt;
+    std::vector<uint32_t> m_nodeOrder;      // Load order of each node, if they were reordered
+    std::vector<uint32_t> m_inBegin;        // Incoming edges of node i are [m_inBegin[i],m_inBegin[i+1])
+    std::vector<uint32_t> m_outBegin;       // Outgoing edges of node i are m_outEdges[m_outBegin[i],m_outBegin[i+1])
+    std::vector<uint32_t> m_outEdges;
+    
     std::deque<output> m_outputs;
     SupervisorDevice m_supervisor;
+    std::vector<uint32_t> m_supervisorTag;  // Value returned by onAttachNode for each node
     
-    std::ostream &m_statsDst;
+    StatsWriter m_statsWriter;
     stats m_stats;
     
+    // State used by the active-set engine. A node is only re-evaluated if it
+    // sent in the previous step, received a delivery, or was blocked and had
+    // an outgoing edge drain, as otherwise its idle/blocked status can't have
+    // changed. Candidates are kept as bitmaps, so they are visited in index
+    // order without sorting.
+    // Messages are scheduled into a timing wheel bucket keyed by their
+    // delivery step, so an in-flight edge costs nothing until it arrives.
+    // Each bucket is a bitmap over the edges, so its deliveries come out in
+    // edge order without sorting, for wheelSize*numEdges/8 bytes in total.
+    // An occupied edge keeps a non-zero messageStatus, but it isn't counted down.
+    std::vector<IndexBitmap> m_wheel;       // Edges to deliver, indexed by step & m_wheelMask
+    uint32_t m_wheelMask;
+    uint32_t m_inFlight;                    // Number of edges currently holding a message
+    IndexBitmap m_candidates;               // Nodes to evaluate in this step
+    IndexBitmap m_nextCandidates;           // Nodes to evaluate in the next step
+    std::vector<uint8_t> m_nodeBlocked;     // Was node blocked when last evaluated
+    uint32_t m_blockedCount;                // Number of nodes currently blocked
+    
+    // State used by the multi-threaded scan engine
+    std::unique_ptr<ThreadTeam> m_team;
+    std::vector<worker> m_workers;
+    
+    // Properties which the device handlers are given for a node
+    const hot_properties_type *hot(uint32_t index) const
+    { return hot(index, std::integral_constant<bool,hot_properties<TGraph>::available>()); }
+    
+    const hot_properties_type *hot(uint32_t index, std::true_type) const
+    { return &m_hotProperties[index]; }
+    
+    const hot_properties_type *hot(uint32_t index, std::false_type) const
+    { return &m_properties[index]; }
+    
+    // Properties which the supervisor and logging are given for a node
+    const cold_properties_type *cold(uint32_t index) const
+    { return cold(index, std::integral_constant<bool,hot_properties<TGraph>::available>()); }
+    
+    const cold_properties_type *cold(uint32_t index, std::true_type) const
+    { return &m_coldProperties[index]; }
+    
+    const cold_properties_type *cold(uint32_t index, std::false_type) const
+    { return &m_properties[index]; }
+    
+    void build_hot_properties(std::true_type)
+    {
+        m_hotProperties.resize(m_properties.size());
+        m_coldProperties.resize(m_properties.size());
+        for(uint32_t i=0; i<m_properties.size(); i++){
+            m_hotProperties[i]=hot_properties<TGraph>::make(&m_graph, m_properties[i]);
+            m_coldProperties[i]=hot_properties<TGraph>::make_cold(m_properties[i]);
+        }
+        std::vector<properties_type>().swap(m_properties);
+    }
+    
+    void build_hot_properties(std::false_type)
+    {}
+    
     // Give a single node (i.e. a device) the chance to
     // send a message.
     // \retval Return true if the device is blocked or sends. False if it is idle.
-    bool step_node(unsigned index, node *n)
+    bool step_node(uint32_t index, stats &counts, std::deque<output> &outputs)
     {       
-        if(!TGraph::ready_to_send(&m_graph, &(n->properties), &(n->state)) ){
-            log(4, "  node %u : idle", index);
-            m_stats.nodeIdleSteps++;
+        const cold_properties_type *properties=cold(index);
+        device_type *state=&m_state[index];
+        
+        if(!TGraph::ready_to_send(&m_graph, hot(index), state) ){
+            log<4>("  node %u : idle", index);
+            counts.nodeIdleSteps++;
             return false; // Device doesn't want to send
         }
         
-        for(unsigned i=0; i < n->outgoing.size(); i++){
-            if( n->outgoing[i]->messageStatus>0 ){
-                log(3, "  node %u : blocked on %u->%u", index, n->outgoing[i]->src->properties.id, n->outgoing[i]->src->properties.id);
-                m_stats.nodeBlockedSteps++;
+        const uint32_t *outBegin=&m_outEdges[0]+m_outBegin[index];
+        const uint32_t *outEnd=&m_outEdges[0]+m_outBegin[index+1];
+        
+        for(const uint32_t *e=outBegin; e < outEnd; e++){
+            if( m_edgeStatus[*e]>0 ){
+                log<3>("  node %u : blocked on %u->%u", index, cold(m_edgeSrc[*e])->id, cold(m_edgeDst[*e])->id);
+                counts.nodeBlockedSteps++;
                 return true; // One of the outputs is full, so we are blocked
             }
         }
         
-        log(3, "  node %u : send", index);
-        m_stats.nodeSendSteps++;
+        if(!m_supervisor.canSend(properties, m_supervisorTag[index], state)){
+            log<3>("  node %u : held back by supervisor", index);
+            counts.nodeBlockedSteps++;
+            return true;
+        }
+        
+        log<3>("  node %u : send", index);
+        counts.nodeSendSteps++;
         
         message_type message;
         
@@ -142,21 +308,23 @@ private:
         bool doOutput = TGraph::on_send(
             &m_graph,
             &message,
-            &(n->properties),
-            &(n->state)
+            hot(index),
+            state
         );
         
-        for(unsigned i=0; i < n->outgoing.size(); i++){
-            assert( 0 == n->outgoing[i]->messageStatus );
-            n->outgoing[i]->messageData = message; // Copy message into channel
-            n->outgoing[i]->messageStatus = 1 + n->outgoing[i]->delay; // How long until it is ready?
+        for(const uint32_t *e=outBegin; e < outEnd; e++){
+            assert( 0 == m_edgeStatus[*e] );
+            m_edgeMessage[*e] = message; // Copy message into channel
+            m_edgeStatus[*e] = 1 + m_edgeDelay[*e]; // How long until it is ready?
         }
         
         if(doOutput){
-            log(3, "  node %u : output", index);    
+            log<3>("  node %u : output", index);    
 
-            m_outputs.push_back( output{
-                &(n->properties),
+            outputs.push_back( output{
+                properties,
+                m_nodeOrder.empty() ? index : m_nodeOrder[index],
+                m_supervisorTag[index],
                 message,
                 m_step
             } );
@@ -166,62 +334,477 @@ private:
         return true;
     }
     
-    bool step_edge(unsigned index, edge *e)
+    // Deliver the message held in an edge to the destination device
+    void deliver_edge(uint32_t index, stats &counts)
     {
-        if(e->messageStatus == 0){
-            log(4, "  edge %u -> %u : empty", e->src->properties.id, e->dst->properties.id);
-            m_stats.edgeIdleSteps++;
+        log<3>("  edge %u -> %u : deliver", cold(m_edgeSrc[index])->id, cold(m_edgeDst[index])->id);
+        counts.edgeDeliverSteps++;
+        
+        uint32_t dst=m_edgeDst[index];
+        TGraph::on_recv(
+            &m_graph,
+            &m_edgeChannel[index],
+            &m_edgeMessage[index],
+            hot(dst),
+            &m_state[dst]
+        );
+        m_edgeStatus[index]=0; // The edge is now idle
+    }
+    
+    bool step_edge(uint32_t index, stats &counts)
+    {
+        uint32_t &status=m_edgeStatus[index];
+        
+        if(status == 0){
+            log<4>("  edge %u -> %u : empty", cold(m_edgeSrc[index])->id, cold(m_edgeDst[index])->id);
+            counts.edgeIdleSteps++;
             return false;
         }
         
-        if(e->messageStatus > 1){
-            log(3, "  edge %u -> %u : delay (%u)", e->src->properties.id, e->dst->properties.id, e->messageStatus);
-            e->messageStatus--;
-            m_stats.edgeTransitSteps++;
+        if(status > 1){
+            log<3>("  edge %u -> %u : delay (%u)", cold(m_edgeSrc[index])->id, cold(m_edgeDst[index])->id, status);
+            status--;
+            counts.edgeTransitSteps++;
             return true;
         }
        
-        log(3, "  edge %u -> %u : deliver", e->src->properties.id, e->dst->properties.id);
-        m_stats.edgeDeliverSteps++;
-            
-        
         // Deliver the message to the device
-        TGraph::on_recv(
-            &m_graph,
-            &(e->channel),
-            &(e->messageData),
-            &(e->dst->properties),
-            &(e->dst->state)
-        );
-        e->messageStatus=0; // The edge is now idle
+        deliver_edge(index, counts);
         
         return true;
     }
     
+    // Step the edges [begin,end), through the graph's batch kernel if the batch
+    // engine is selected. Tracing individual edges needs the per-edge path.
+    void step_edge_range(uint32_t begin, uint32_t end, stats &counts)
+    {
+        typedef edge_batch_kernel<TGraph> kernel;
+        bool traceEdges = SIMULATOR_MAX_LOG_LEVEL>=3 && m_logLevel>=3;
+        if(m_options.engine==simulator_options::engine_batch && !traceEdges){
+            step_edge_range(begin, end, counts, std::integral_constant<bool,kernel::available>());
+        }else{
+            step_edge_range(begin, end, counts, std::false_type());
+        }
+    }
+    
+    void step_edge_range(uint32_t begin, uint32_t end, stats &counts, std::false_type)
+    {
+        for(uint32_t i=begin; i<end; i++){
+            step_edge(i, counts);
+        }
+    }
+    
+    void step_edge_range(uint32_t begin, uint32_t end, stats &counts, std::true_type)
+    {
+        edge_batch_kernel<TGraph>::step(
+            &m_graph, begin, end,
+            m_edgeStatus.data(), m_edgeMessage.data(), m_edgeChannel.data(), m_edgeDst.data(),
+            m_properties.data(), m_state.data(),
+            counts.edgeIdleSteps, counts.edgeTransitSteps, counts.edgeDeliverSteps
+        );
+    }
+    
     bool step_all()
     {
-        log(2, "stepping edges");
-        bool active=false;
-        for(unsigned i=0; i<m_edges.size(); i++){
-            active = step_edge(i ,&m_edges[i]) || active;
-        }        
-        log(2, "stepping nodes");
-        for(unsigned i=0; i<m_nodes.size(); i++){
-            active = step_node(i, &m_nodes[i]) || active;
+        log<2>("stepping edges");
+        step_edge_range(0, m_edgeStatus.size(), m_stats);
+        bool active = m_stats.edgeTransitSteps || m_stats.edgeDeliverSteps;
+        log<2>("stepping nodes");
+        for(uint32_t i=0; i<m_state.size(); i++){
+            active = step_node(i, m_stats, m_outputs) || active;
         }
         return active;
     }
     
+    // Equivalent to step_all, but split across the thread team. Edges are
+    // owned by the worker that owns their destination, so deliveries never
+    // race, and in the node phase each edge is only written by its source.
+    // Counts and outputs are merged in worker (i.e. node) order.
+    bool step_parallel()
+    {
+        log<2>("stepping edges");
+        m_team->run([this](unsigned t){
+            worker &w=m_workers[t];
+            w.counts={m_step, 0,0,0, 0,0,0};
+            step_edge_range(m_inBegin[w.nodeBegin], m_inBegin[w.nodeEnd], w.counts);
+        });
+        log<2>("stepping nodes");
+        m_team->run([this](unsigned t){
+            worker &w=m_workers[t];
+            for(uint32_t i=w.nodeBegin; i<w.nodeEnd; i++){
+                step_node(i, w.counts, w.outputs);
+            }
+        });
+        
+        for(unsigned t=0; t<m_workers.size(); t++){
+            worker &w=m_workers[t];
+            m_stats.nodeIdleSteps += w.counts.nodeIdleSteps;
+            m_stats.nodeBlockedSteps += w.counts.nodeBlockedSteps;
+            m_stats.nodeSendSteps += w.counts.nodeSendSteps;
+            m_stats.edgeIdleSteps += w.counts.edgeIdleSteps;
+            m_stats.edgeTransitSteps += w.counts.edgeTransitSteps;
+            m_stats.edgeDeliverSteps += w.counts.edgeDeliverSteps;
+            
+            m_outputs.insert(m_outputs.end(), w.outputs.begin(), w.outputs.end());
+            w.outputs.clear();
+        }
+        
+        return m_stats.nodeBlockedSteps || m_stats.nodeSendSteps
+            || m_stats.edgeTransitSteps || m_stats.edgeDeliverSteps;
+    }
+    
+    // Equivalent to step_all, but only touches edges holding messages and
+    // nodes that could have changed state. The idle counts are derived from
+    // the totals rather than by visiting the idle nodes and edges.
+    bool step_active()
+    {
+        log<2>("stepping active edges");
+        
+        // Everything in flight that isn't arriving now is in transit
+        IndexBitmap &deliveries=m_wheel[m_step & m_wheelMask];
+        m_stats.edgeTransitSteps = m_inFlight - deliveries.count();
+        m_inFlight -= deliveries.count();
+        
+        // Deliver in edge order, so devices see the same sequence of messages as step_all
+        deliveries.drain([&](uint32_t index){
+            deliver_edge(index, m_stats);
+            
+            // The destination has new input, and a blocked source may now be free.
+            // An idle source stays idle, and one that just sent is already queued.
+            m_candidates.insert(m_edgeDst[index]);
+            if(m_nodeBlocked[m_edgeSrc[index]]){
+                m_candidates.insert(m_edgeSrc[index]);
+            }
+        });
+        
+        log<2>("stepping candidate nodes");
+        
+        // Process in index order, so that outputs reach the supervisor in the same order
+        m_candidates.drain([&](uint32_t index){
+            if(m_nodeBlocked[index]){
+                m_nodeBlocked[index]=0;
+                m_blockedCount--;
+            }
+            
+            uint32_t sentBefore=m_stats.nodeSendSteps;
+            if(!step_node(index, m_stats, m_outputs)){
+                return; // Idle, so only a delivery can wake it up
+            }
+            
+            if(m_stats.nodeSendSteps==sentBefore){
+                // Blocked, so wait for an outgoing edge to drain
+                m_nodeBlocked[index]=1;
+                m_blockedCount++;
+                if(m_options.maxSlices){
+                    // ... or the supervisor to catch up, which nothing signals
+                    m_nextCandidates.insert(index);
+                }
+            }else{
+                // Sent, so state has changed and it must be looked at next step
+                // step_node set each status to 1+delay, which is also the
+                // number of steps until delivery.
+                for(uint32_t j=m_outBegin[index]; j<m_outBegin[index+1]; j++){
+                    uint32_t e=m_outEdges[j];
+                    m_wheel[(m_step + m_edgeStatus[e]) & m_wheelMask].insert(e);
+                }
+                m_inFlight += m_outBegin[index+1]-m_outBegin[index];
+                m_nextCandidates.insert(index);
+            }
+        });
+        std::swap(m_candidates, m_nextCandidates);
+        
+        // step_node counted the idle candidates, so replace with the total
+        m_stats.nodeBlockedSteps = m_blockedCount;
+        m_stats.nodeIdleSteps = m_state.size() - m_stats.nodeBlockedSteps - m_stats.nodeSendSteps;
+        m_stats.edgeIdleSteps = m_edgeStatus.size() - m_stats.edgeTransitSteps - m_stats.edgeDeliverSteps;
+        
+        return m_stats.nodeBlockedSteps || m_stats.nodeSendSteps
+            || m_stats.edgeTransitSteps || m_stats.edgeDeliverSteps;
+    }
+    
+    /* After a step in which no node sent and no edge delivered, nothing can
+       change until the next message arrives: node states are frozen, blocked
+       nodes stay blocked, and edges just count down. Returns how many of the
+       following steps are like that, and advances the edges past them. The
+       stats for each of those steps are the same apart from stepIndex, so
+       they are returned once in quiet.
+       
+       This needs the whole graph to be waiting at once, so it rarely helps
+       graphs with random delays, where the devices' times soon spread out
+       and some part of the graph is always busy. It pays off when delays are
+       large and uniform, e.g. generate_heat_rect with a linkDelay, where the
+       devices move in lockstep. */
+    uint32_t quiescent_steps(stats &quiet)
+    {
+        uint32_t skip=0;
+        
+        if(m_options.engine==simulator_options::engine_active){
+            // Nothing is due to be looked at next step, so find the next delivery
+            if(!m_candidates.empty() || m_inFlight==0)
+                return 0;
+            while(m_wheel[(m_step+skip+1) & m_wheelMask].empty()){
+                skip++;
+            }
+            quiet.nodeBlockedSteps=m_blockedCount;
+            quiet.edgeTransitSteps=m_inFlight;
+        }else{
+            if(m_stats.nodeSendSteps || m_stats.edgeDeliverSteps || !m_stats.edgeTransitSteps)
+                return 0;
+            // An edge with status s delivers in s steps time
+            uint32_t next=UINT32_MAX;
+            for(uint32_t i=0; i<m_edgeStatus.size(); i++){
+                if(m_edgeStatus[i]){
+                    next=std::min(next, m_edgeStatus[i]);
+                }
+            }
+            skip=next-1;
+            if(skip){
+                for(uint32_t i=0; i<m_edgeStatus.size(); i++){
+                    if(m_edgeStatus[i]){
+                        m_edgeStatus[i] -= skip;
+                    }
+                }
+            }
+            quiet.nodeBlockedSteps=m_stats.nodeBlockedSteps;
+            quiet.edgeTransitSteps=m_stats.edgeTransitSteps;
+        }
+        
+        quiet.stepIndex=m_step+1;
+        quiet.nodeIdleSteps=m_state.size()-quiet.nodeBlockedSteps;
+        quiet.nodeSendSteps=0;
+        quiet.edgeIdleSteps=m_edgeStatus.size()-quiet.edgeTransitSteps;
+        quiet.edgeDeliverSteps=0;
+        return skip;
+    }
+    
+    /* Functional simulation, which ignores delays and blocking, and delivers
+       each message to all its destinations as soon as it is sent. Nodes are
+       swept in rounds, where each round gives every node whose state changed
+       in the previous round a chance to send. This is only meaningful for
+       applications whose answer doesn't depend on network timing (such as
+       heat), and there are no hardware statistics to report. */
+    void run_functional()
+    {
+        uint32_t round=0;
+        uint64_t messages=0;
+        
+        while(!m_candidates.empty()){
+            log<2>("round %u : %u candidates", round, m_candidates.count());
+            
+            m_candidates.drain([&](uint32_t index){
+                const cold_properties_type *properties=cold(index);
+                device_type *state=&m_state[index];
+                
+                if(!TGraph::ready_to_send(&m_graph, hot(index), state))
+                    return;
+                if(!m_supervisor.canSend(properties, m_supervisorTag[index], state)){
+                    m_nextCandidates.insert(index); // Try again once the supervisor has caught up
+                    return;
+                }
+                
+                message_type message;
+                bool doOutput = TGraph::on_send(&m_graph, &message, hot(index), state);
+                messages++;
+                
+                for(uint32_t j=m_outBegin[index]; j<m_outBegin[index+1]; j++){
+                    uint32_t e=m_outEdges[j];
+                    uint32_t dst=m_edgeDst[e];
+                    TGraph::on_recv(&m_graph, &m_edgeChannel[e], &message, hot(dst), &m_state[dst]);
+                    m_nextCandidates.insert(dst);
+                }
+                m_nextCandidates.insert(index);
+                
+                if(doOutput){
+                    m_outputs.push_back( output{
+                        properties,
+                        m_nodeOrder.empty() ? index : m_nodeOrder[index],
+                        m_supervisorTag[index],
+                        message,
+                        round
+                    } );
+                }
+            });
+            std::swap(m_candidates, m_nextCandidates);
+            
+            flush_outputs();
+            round++;
+        }
+        
+        log<1>("functional simulation finished after %u rounds and %llu messages", round, (unsigned long long)messages);
+    }
+    
+    // Pass any outputs from the queue to the supervisor, in the order
+    // the devices would have produced them without reordering.
+    void flush_outputs()
+    {
+        if(!m_nodeOrder.empty()){
+            std::stable_sort(m_outputs.begin(), m_outputs.end(), [](const output &a, const output &b){
+                return a.sourceOrder < b.sourceOrder;
+            });
+        }
+        while(!m_outputs.empty()){
+            const output &o = m_outputs.front();
+            m_supervisor.onDeviceOutput(o.source, o.supervisorTag, &o.output);
+            m_outputs.pop_front();
+        }
+    }
+    
+    // Reorder nodes if requested, sort edges by destination, and build the
+    // compressed adjacency lists. Devices are attached to the supervisor here,
+    // once they have reached their final place in memory.
+    void build_topology()
+    {
+        if(m_topologyBuilt)
+            return;
+        
+        log<2>("building topology");
+        
+        uint32_t numNodes=m_properties.size();
+        uint32_t numEdges=m_edgeSrc.size();
+        
+        if(m_options.reorder==simulator_options::reorder_rcm){
+            log<2>("reordering nodes");
+            m_nodeOrder=reverse_cuthill_mckee(numNodes, m_edgeSrc, m_edgeDst);
+            
+            std::vector<uint32_t> rank(numNodes);
+            for(uint32_t i=0; i<numNodes; i++){
+                rank[m_nodeOrder[i]]=i;
+            }
+            
+            std::vector<properties_type> properties(m_properties);
+            for(uint32_t i=0; i<numNodes; i++){
+                m_properties[i]=properties[m_nodeOrder[i]];
+            }
+            for(uint32_t i=0; i<numEdges; i++){
+                m_edgeSrc[i]=rank[m_edgeSrc[i]];
+                m_edgeDst[i]=rank[m_edgeDst[i]];
+            }
+            
+            m_supervisorTag.resize(numNodes);
+            for(uint32_t i=0; i<numNodes; i++){
+                m_supervisorTag[rank[i]]=m_supervisor.onAttachNode(&m_properties[rank[i]]);
+            }
+        }else{
+            m_supervisorTag.resize(numNodes);
+            for(uint32_t i=0; i<numNodes; i++){
+                m_supervisorTag[i]=m_supervisor.onAttachNode(&m_properties[i]);
+            }
+        }
+        build_hot_properties(std::integral_constant<bool,hot_properties<TGraph>::available>());
+        
+        // Counting sort by destination, which is stable so each node keeps
+        // its incoming edges in load order.
+        m_inBegin.assign(numNodes+1, 0);
+        for(uint32_t i=0; i<numEdges; i++){
+            m_inBegin[m_edgeDst[i]+1]++;
+        }
+        for(uint32_t i=0; i<numNodes; i++){
+            m_inBegin[i+1] += m_inBegin[i];
+        }
+        std::vector<uint32_t> order(numEdges);
+        {
+            std::vector<uint32_t> pos(m_inBegin.begin(), m_inBegin.end()-1);
+            for(uint32_t i=0; i<numEdges; i++){
+                order[pos[m_edgeDst[i]]++]=i;
+            }
+        }
+        
+        std::vector<uint32_t> edgeSrc(numEdges), edgeDst(numEdges), edgeDelay(numEdges);
+        std::vector<channel_type> edgeChannel(numEdges);
+        for(uint32_t i=0; i<numEdges; i++){
+            edgeSrc[i]=m_edgeSrc[order[i]];
+            edgeDst[i]=m_edgeDst[order[i]];
+            edgeDelay[i]=m_edgeDelay[order[i]];
+            edgeChannel[i]=m_edgeChannel[order[i]];
+        }
+        m_edgeSrc.swap(edgeSrc);
+        m_edgeDst.swap(edgeDst);
+        m_edgeDelay.swap(edgeDelay);
+        m_edgeChannel.swap(edgeChannel);
+        
+        // Outgoing lists, in (sorted) edge order
+        m_outBegin.assign(numNodes+1, 0);
+        for(uint32_t i=0; i<numEdges; i++){
+            m_outBegin[m_edgeSrc[i]+1]++;
+        }
+        for(uint32_t i=0; i<numNodes; i++){
+            m_outBegin[i+1] += m_outBegin[i];
+        }
+        m_outEdges.resize(numEdges);
+        {
+            std::vector<uint32_t> pos(m_outBegin.begin(), m_outBegin.end()-1);
+            for(uint32_t i=0; i<numEdges; i++){
+                m_outEdges[pos[m_edgeSrc[i]]++]=i;
+            }
+        }
+        
+        m_edgeStatus.assign(numEdges, 0);
+        m_edgeMessage.resize(numEdges);
+        
+        m_topologyBuilt=true;
+    }
+    
     void reset()
     {
-        log(2, "resetting nodes");
+        build_topology();
+        
+        log<2>("resetting nodes");
         m_step=0;
-        for(unsigned i=0; i<m_nodes.size(); i++){
-            TGraph::on_init(&m_graph, &m_nodes[i].properties, &m_nodes[i].state);
+        for(uint32_t i=0; i<m_state.size(); i++){
+            TGraph::on_init(&m_graph, hot(i), &m_state[i]);
+        }
+        log<2>("resetting edges");
+        std::fill(m_edgeStatus.begin(), m_edgeStatus.end(), 0);
+        
+        if(m_options.engine==simulator_options::engine_active || m_options.engine==simulator_options::engine_functional){
+            // A message sent in step s with delay d arrives in step s+1+d, so
+            // the wheel must cover at least maxDelay+2 steps to avoid aliasing.
+            uint32_t maxDelay=0;
+            for(uint32_t i=0; i<m_edgeDelay.size(); i++){
+                maxDelay=std::max(maxDelay, m_edgeDelay[i]);
+            }
+            uint32_t wheelSize=1;
+            while(wheelSize < maxDelay+2){
+                wheelSize*=2;
+            }
+            m_wheel.resize(wheelSize);
+            for(uint32_t i=0; i<wheelSize; i++){
+                m_wheel[i].reset(m_edgeStatus.size());
+            }
+            m_wheelMask=wheelSize-1;
+            m_inFlight=0;
+            
+            // Every node gets looked at in the first step
+            m_candidates.reset(m_state.size());
+            for(uint32_t i=0; i<m_state.size(); i++){
+                m_candidates.insert(i);
+            }
+            m_nextCandidates.reset(m_state.size());
+            m_nodeBlocked.assign(m_state.size(), 0);
+            m_blockedCount=0;
         }
-        log(2, "resetting edges");
-        for(unsigned i=0; i<m_edges.size(); i++){
-            m_edges[i].messageStatus = 0;
+        
+        if(m_options.engine!=simulator_options::engine_active && m_options.threads>1){
+            // Split so each worker has roughly the same number of nodes plus edges
+            uint32_t numNodes=m_state.size();
+            uint64_t total=numNodes+m_edgeStatus.size();
+            unsigned numWorkers=std::max(1u, std::min<unsigned>(m_options.threads, numNodes));
+            
+            m_workers.resize(numWorkers);
+            uint32_t node=0;
+            for(unsigned t=0; t<numWorkers; t++){
+                uint64_t target=(total*(t+1))/numWorkers;
+                m_workers[t].nodeBegin=node;
+                while(node<numNodes && (t+1==numWorkers || node+1+(uint64_t)m_inBegin[node+1] <= target)){
+                    node++;
+                }
+                m_workers[t].nodeEnd=node;
+            }
+            
+            if(!m_team || m_team->size()!=numWorkers){
+                log<2>("starting %u threads", numWorkers);
+                m_team.reset(new ThreadTeam(numWorkers));
+            }
         }
     }
     
@@ -232,28 +815,41 @@ public:
         FILE *destFile,
         const graph_type &graph,
         unsigned numDevices, 
-        unsigned numChannels
+        unsigned numChannels,
+        const simulator_options &options = simulator_options()
     )
         : m_logLevel(logLevel)
+        , m_options(options)
         , m_step(0)
         , m_graph(graph)
-        , m_supervisor(&m_graph, destFile)
-        , m_statsDst(stats)
+        , m_topologyBuilt(false)
+        , m_supervisor(&m_graph, destFile, options.outputFormat, options.maxSlices)
+        , m_statsWriter(stats, options.statsFormat)
     {
-        m_nodes.reserve(numDevices);
-        m_edges.reserve(numChannels);
+        // Outputs point at the properties, so they must never move once built
+        m_properties.reserve(numDevices);
+        m_state.reserve(numDevices);
+        
+        m_edgeSrc.reserve(numChannels);
+        m_edgeDst.reserve(numChannels);
+        m_edgeDelay.reserve(numChannels);
+        m_edgeChannel.reserve(numChannels);
     }
     
     
     unsigned addDevice(
         const properties_type &device
     ){
-        unsigned index=m_nodes.size();
-        node n;
-        n.properties=device;
-        m_nodes.push_back(n);
+        if(m_topologyBuilt){
+            throw std::runtime_error("Simulator::addDevice - can't add devices after the simulation has started.");
+        }
+        if(m_properties.size()==m_properties.capacity()){
+            throw std::runtime_error("Simulator::addDevice - more devices than declared in header.");
+        }
         
-        m_supervisor.onAttachNode(&m_nodes[index].properties);
+        unsigned index=m_properties.size();
+        m_properties.push_back(device);
+        m_state.push_back(device_type());
         
         return index;
     }
@@ -264,51 +860,84 @@ public:
         unsigned delay,
         const channel_type &channel
     ){
-        unsigned edgeIndex = m_edges.size();
-        edge e;
-        e.src = &m_nodes.at(srcIndex);
-        e.dst = &m_nodes.at(dstIndex);
-        e.delay = delay;
-        e.channel = channel;
-        e.messageStatus=0;
-        m_edges.push_back(e);
-        
-        m_nodes.at(srcIndex).outgoing.push_back( &m_edges[edgeIndex] );
-        m_nodes.at(dstIndex).incoming.push_back( &m_edges[edgeIndex] );
+        if(m_topologyBuilt){
+            throw std::runtime_error("Simulator::addChannel - can't add channels after the simulation has started.");
+        }
+        if(srcIndex>=m_properties.size() || dstIndex>=m_properties.size()){
+            throw std::runtime_error("Simulator::addChannel - node index out of range.");
+        }
+        
+        m_edgeSrc.push_back(srcIndex);
+        m_edgeDst.push_back(dstIndex);
+        m_edgeDelay.push_back(delay);
+        m_edgeChannel.push_back(channel);
     }
     
     
     
 
+    // Only written when slices are capped, as otherwise the stats are
+    // exactly one row per step
+    void write_summary()
+    {
+        log<1>("supervisor had at most %u output slices in progress", m_supervisor.peakSlices());
+        if(m_options.maxSlices){
+            m_statsWriter.writeSummary(stats_summary_peak_slices, m_supervisor.peakSlices());
+        }
+        m_statsWriter.flush();
+    }
+    
     void run()
     {
-        log(1, "begin run");
+        log<1>("begin run");
         
         bool active=true;
         
         reset();
         
+        if(m_options.engine==simulator_options::engine_functional){
+            run_functional();
+            m_supervisor.onFinish();
+            write_summary();
+            return;
+        }
+        
         while(active){
-            log(1, "step %u", m_step);
+            log<1>("step %u", m_step);
             
             m_stats={m_step, 0,0,0, 0,0,0};
 
             // Run all the nodes
-            active = step_all();
+            if(m_options.engine==simulator_options::engine_active){
+                active = step_active();
+            }else if(m_team){
+                active = step_parallel();
+            }else{
+                active = step_all();
+            }
             
             // Flush any outputs from the queue to the supervisor
-            while(!m_outputs.empty()){
-                const output &o = m_outputs.front();
-                m_supervisor.onDeviceOutput(o.source, &o.output);
-                m_outputs.pop_front();
-            }
+            flush_outputs();
             
             // Send statistics out
-            m_statsDst<<m_stats.stepIndex<<", "<<m_stats.nodeIdleSteps<<", "<<m_stats.nodeBlockedSteps<<", "<<m_stats.nodeSendSteps;
-            m_statsDst<<", "<<m_stats.edgeIdleSteps<<", "<<m_stats.edgeTransitSteps<<", "<<m_stats.edgeDeliverSteps<<"\n";
+            m_statsWriter.writeRows(m_stats);
+            
+            // Jump over any steps where messages are only in transit
+            if(active){
+                stats quiet;
+                uint32_t skip=quiescent_steps(quiet);
+                if(skip){
+                    log<1>("steps %u to %u are quiescent", m_step+1, m_step+skip);
+                    m_statsWriter.writeRows(quiet, skip);
+                    m_step += skip;
+                }
+            }
 
             m_step++;            
          }
+         
+         m_supervisor.onFinish();
+         write_summary();
     }
 };
 
@@ -0,0 +1,222 @@
+#ifndef stats_writer_hpp
+#define stats_writer_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+/* Statistics for one step of the hardware model, which become one row of
+   the stats file. */
+struct step_stats
+{
+    uint32_t stepIndex;
+
+    uint32_t nodeIdleSteps;
+    uint32_t nodeBlockedSteps;
+    uint32_t nodeSendSteps;
+
+    uint32_t edgeIdleSteps;
+    uint32_t edgeTransitSteps;
+    uint32_t edgeDeliverSteps;
+};
+
+/* Counters which describe the whole run rather than one step. They follow
+   the last row, as a "# name, value" line in text. */
+enum stats_summary_type
+{
+    stats_summary_peak_slices=1     // Most output slices the supervisor had in progress at once
+};
+
+inline const char *stats_summary_name(uint32_t type)
+{
+    switch(type){
+    case stats_summary_peak_slices: return "peakSlices";
+    default: throw std::runtime_error("stats_summary_name - unknown summary type.");
+    }
+}
+
+/* The binary stats format is the eight byte magic string below followed by
+   a sequence of stats_record, in host byte order. Each record stands for
+   `count` rows with consecutive step indices starting at `stepIndex`, and
+   all other columns equal. A record with a count of zero is instead a
+   summary counter, with the stats_summary_type in `stepIndex` and the value
+   in `nodeIdleSteps`. */
+static const char stats_binary_magic[8]={'P','S','T','A','T','S','0','1'};
+
+struct stats_record
+{
+    step_stats row;
+    uint32_t count;
+};
+
+static_assert(std::is_trivially_copyable<stats_record>::value && sizeof(stats_record)==32, "stats_record must be a fixed-width record.");
+
+/* Writes stats rows to a stream, either as the original comma separated text
+   or in the binary format. Output is buffered, and only guaranteed to have
+   reached the stream after flush(). */
+class StatsWriter
+{
+public:
+    enum format_type
+    {
+        format_text,    // "step, nodeIdle, nodeBlocked, nodeSend, edgeIdle, edgeTransit, edgeDeliver" lines
+        format_binary   // Run-length encoded stats_record
+    };
+
+private:
+    std::ostream &m_dst;
+    format_type m_format;
+
+    std::string m_buffer;
+
+    bool m_havePending;
+    stats_record m_pending;     // Binary record which may still be extended
+
+    static const size_t FLUSH_SIZE=1<<16;
+
+    static bool same_values(const step_stats &a, const step_stats &b)
+    {
+        return a.nodeIdleSteps==b.nodeIdleSteps && a.nodeBlockedSteps==b.nodeBlockedSteps
+            && a.nodeSendSteps==b.nodeSendSteps && a.edgeIdleSteps==b.edgeIdleSteps
+            && a.edgeTransitSteps==b.edgeTransitSteps && a.edgeDeliverSteps==b.edgeDeliverSteps;
+    }
+
+    static void append_uint(std::string &dst, uint32_t x)
+    {
+        char tmp[10];
+        unsigned n=0;
+        do{
+            tmp[n++]='0'+(x%10);
+            x/=10;
+        }while(x);
+        while(n){
+            dst.push_back(tmp[--n]);
+        }
+    }
+
+    void append_text(const step_stats &s)
+    {
+        append_uint(m_buffer, s.stepIndex);
+        m_buffer.append(", ");  append_uint(m_buffer, s.nodeIdleSteps);
+        m_buffer.append(", ");  append_uint(m_buffer, s.nodeBlockedSteps);
+        m_buffer.append(", ");  append_uint(m_buffer, s.nodeSendSteps);
+        m_buffer.append(", ");  append_uint(m_buffer, s.edgeIdleSteps);
+        m_buffer.append(", ");  append_uint(m_buffer, s.edgeTransitSteps);
+        m_buffer.append(", ");  append_uint(m_buffer, s.edgeDeliverSteps);
+        m_buffer.push_back('\n');
+    }
+
+    void write_buffer()
+    {
+        m_dst.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+    void retire_pending()
+    {
+        if(m_havePending){
+            m_buffer.append((const char*)&m_pending, sizeof(m_pending));
+            m_havePending=false;
+        }
+    }
+public:
+    StatsWriter(std::ostream &dst, format_type format=format_text)
+        : m_dst(dst)
+        , m_format(format)
+        , m_havePending(false)
+    {
+        if(m_format==format_binary){
+            m_buffer.append(stats_binary_magic, sizeof(stats_binary_magic));
+        }
+    }
+
+    ~StatsWriter()
+    {
+        flush();
+    }
+
+    // Write count rows which are the same as s apart from the step index,
+    // which increases by one each row.
+    void writeRows(const step_stats &s, uint32_t count=1)
+    {
+        if(count==0)
+            return;
+
+        if(m_format==format_text){
+            step_stats row=s;
+            for(uint32_t i=0; i<count; i++){
+                append_text(row);
+                row.stepIndex++;
+                if(m_buffer.size() >= FLUSH_SIZE){
+                    write_buffer();
+                }
+            }
+        }else{
+            if(m_havePending && same_values(m_pending.row, s)
+                && m_pending.row.stepIndex+m_pending.count==s.stepIndex && m_pending.count+count > m_pending.count){
+                m_pending.count += count;
+            }else{
+                retire_pending();
+                m_pending.row=s;
+                m_pending.count=count;
+                m_havePending=true;
+            }
+            if(m_buffer.size() >= FLUSH_SIZE){
+                write_buffer();
+            }
+        }
+    }
+
+    // Write a counter for the whole run, after the last row
+    void writeSummary(stats_summary_type type, uint32_t value)
+    {
+        const char *name=stats_summary_name(type);
+        if(m_format==format_text){
+            m_buffer.append("# ");
+            m_buffer.append(name);
+            m_buffer.append(", ");
+            append_uint(m_buffer, value);
+            m_buffer.push_back('\n');
+        }else{
+            retire_pending();
+            stats_record record;
+            memset(&record, 0, sizeof(record));
+            record.row.stepIndex=type;
+            record.row.nodeIdleSteps=value;
+            m_buffer.append((const char*)&record, sizeof(record));
+        }
+    }
+
+    void flush()
+    {
+        retire_pending();
+        write_buffer();
+        m_dst.flush();
+    }
+};
+
+// Checks for the magic string at the start of a binary stats stream
+inline void read_stats_header(std::istream &src)
+{
+    char magic[sizeof(stats_binary_magic)];
+    if(!src.read(magic, sizeof(magic)) || memcmp(magic, stats_binary_magic, sizeof(magic))){
+        throw std::runtime_error("read_stats_header - not a binary stats stream.");
+    }
+}
+
+// Reads the next record of a binary stats stream, returning false at the end
+inline bool read_stats_record(std::istream &src, stats_record &record)
+{
+    src.read((char*)&record, sizeof(record));
+    if(src.gcount()==0 && src.eof())
+        return false;
+    if(src.gcount()!=sizeof(record)){
+        throw std::runtime_error("read_stats_record - truncated record.");
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef text_cursor_hpp
+#define text_cursor_hpp
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <streambuf>
+#include <istream>
+
+/* Reads whitespace separated fields directly out of a line of text, without
+   allocating or going through iostreams. Used by the graph loader, and by
+   graph types to give fast parse_text overloads for their records. Numbers
+   are accepted under the same rules as operator>>, except that unsigned
+   fields can't be negative, and bools must be 0 or 1 (as operator<< writes
+   them). */
+struct text_cursor
+{
+    const char *p;
+    const char *end;
+
+    static bool is_space(char c)
+    { return c==' ' || c=='\t' || c=='\r' || c=='\n' || c=='\v' || c=='\f'; }
+
+    void skip_space()
+    {
+        while(p<end && is_space(*p)){
+            p++;
+        }
+    }
+
+    template<class T>
+    bool read(T &x)
+    {
+        static_assert(std::is_integral<T>::value, "text_cursor can only read integers.");
+
+        skip_space();
+        bool negative=false;
+        if(p<end && (*p=='-' || *p=='+')){
+            negative = *p=='-';
+            p++;
+        }
+        if(p==end || *p<'0' || *p>'9')
+            return false;
+
+        // Accumulate the magnitude, checking against the range of T
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t limit = !negative ? uint64_t(std::numeric_limits<T>::max())
+            : std::is_signed<T>::value ? uint64_t(std::numeric_limits<T>::max())+1 : 0;
+        uint64_t acc=0;
+        while(p<end && *p>='0' && *p<='9'){
+            acc=acc*10+(*p-'0');
+            if(acc>limit)
+                return false;
+            p++;
+        }
+        x = negative ? T(U(0)-U(acc)) : T(acc);
+        return true;
+    }
+
+    bool read(bool &x)
+    {
+        uint8_t v;
+        if(!read(v) || v>1)
+            return false;
+        x = v!=0;
+        return true;
+    }
+};
+
+/* Fallback for types without their own parse_text, which goes through their
+   operator>> on a stream over the remaining text. */
+template<class T>
+bool parse_text(text_cursor &c, T &x)
+{
+    struct memory_buffer
+        : public std::streambuf
+    {
+        memory_buffer(const char *begin, const char *end)
+        { setg((char*)begin, (char*)begin, (char*)end); }
+
+        const char *pos() const
+        { return gptr(); }
+    };
+
+    memory_buffer buffer(c.p, c.end);
+    std::istream src(&buffer);
+    if(!(src>>x))
+        return false;
+    c.p=buffer.pos();
+    return true;
+}
+
+#endif
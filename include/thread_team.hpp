@@ -0,0 +1,118 @@
+#ifndef thread_team_hpp
+#define thread_team_hpp
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+/* A fixed set of threads which repeatedly run the same task in lock-step.
+   Each call to run() executes task(i) once for every i in [0,size()), with
+   the calling thread acting as thread 0, and only returns once all of them
+   have finished. So consecutive calls to run() are separated by a barrier. */
+class ThreadTeam
+{
+private:
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    const std::function<void(unsigned)> *m_task;
+    uint64_t m_generation;  // Incremented each time a new task is started
+    unsigned m_pending;     // Number of helper threads still running the task
+    bool m_quit;
+
+    std::exception_ptr m_error;
+
+    void execute(unsigned index)
+    {
+        try{
+            (*m_task)(index);
+        }catch(...){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(!m_error){
+                m_error=std::current_exception();
+            }
+        }
+    }
+
+    void worker(unsigned index)
+    {
+        uint64_t seen=0;
+        while(1){
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&](){ return m_quit || m_generation!=seen; });
+                if(m_quit)
+                    return;
+                seen=m_generation;
+            }
+
+            execute(index);
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if(--m_pending==0){
+                    m_done.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+    ThreadTeam(unsigned size)
+        : m_task(0)
+        , m_generation(0)
+        , m_pending(0)
+        , m_quit(false)
+    {
+        for(unsigned i=1; i<size; i++){
+            m_threads.push_back(std::thread([this,i](){ worker(i); }));
+        }
+    }
+
+    ~ThreadTeam()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_quit=true;
+        }
+        m_start.notify_all();
+        for(unsigned i=0; i<m_threads.size(); i++){
+            m_threads[i].join();
+        }
+    }
+
+    unsigned size() const
+    { return m_threads.size()+1; }
+
+    void run(const std::function<void(unsigned)> &task)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task=&task;
+            m_pending=m_threads.size();
+            m_generation++;
+        }
+        m_start.notify_all();
+
+        execute(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&](){ return m_pending==0; });
+        m_task=0;
+
+        if(m_error){
+            std::exception_ptr error=m_error;
+            m_error=std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+#endif
@@ -2,9 +2,13 @@
 
 #include "simulator.hpp"
 #include "graph_loader.hpp"
+#include "graph_binary.hpp"
+#include "gzip_stream.hpp"
 
 
 #include "graphs/heat.hpp"
+#include "graphs/heat_kernels.hpp"
+#include "graphs/heat_compact.hpp"
 #include "graphs/ring.hpp"
 
 
@@ -21,7 +25,7 @@
 
 
 template<class TGraph>
-void simulate(int logLevel, unsigned &lineNumber, std::istream &src, std::ostream &stats, FILE *dst)
+void simulate(int logLevel, const simulator_options &options, unsigned &lineNumber, std::istream &src, std::ostream &stats, FILE *dst)
 {
     typename TGraph::graph_type graph;
     unsigned numDevices, numChannels;
@@ -37,7 +41,8 @@ void simulate(int logLevel, unsigned &lineNumber, std::istream &src, std::ostrea
     
     Simulator<TGraph> sim(
         logLevel, stats, dst,
-        graph, numDevices, numChannels
+        graph, numDevices, numChannels,
+        options
     );
     
     graph_load_body(
@@ -49,13 +54,68 @@ void simulate(int logLevel, unsigned &lineNumber, std::istream &src, std::ostrea
     sim.run();
 }
 
+template<class TGraph>
+void simulate_binary(int logLevel, const simulator_options &options, const GraphBinaryData &src, std::ostream &stats, FILE *dst)
+{
+    typename TGraph::graph_type graph;
+    unsigned numDevices, numChannels;
+    
+    graph_binary_load_header<TGraph>(
+        src,
+        graph, numDevices, numChannels
+    );
+    
+    if(logLevel > 0){
+        fprintf(stderr, "Load: found binary graph of type '%s' with %u devices and %u channels\n", TGraph::type_name(), numDevices, numChannels);
+    }
+    
+    Simulator<TGraph> sim(
+        logLevel, stats, dst,
+        graph, numDevices, numChannels,
+        options
+    );
+    
+    graph_binary_load_body(
+        src,
+        numDevices, numChannels,
+        sim
+    );
+    
+    sim.run();
+}
+
 void usage()
 {
-    fprintf(stderr, "usage: (srcFile|-) (statsFile|-) (outFile|-) [--log-level level]\n");
-    fprintf(stderr, "  srcFile : Where to read the graph from (or - for stdin)\n");
+    fprintf(stderr, "usage: (srcFile|-) (statsFile|-) (outFile|-) [--log-level level] [--engine scan|active|batch|functional] [--threads n] [--reorder none|rcm] [--functional] [--stats-format text|binary] [--output-format mjpeg|raw|rgb] [--max-slices n] [--compact]\n");
+    fprintf(stderr, "  srcFile : Where to read the graph from (or - for stdin), as text or binary (see bin/tools/convert_graph), optionally gzipped\n");
     fprintf(stderr, "  statsFile : Where to write the statistics to (or - for stdout)\n");
     fprintf(stderr, "  outFile : Where to write the output to (or - for stdout)\n");
     fprintf(stderr, "    (you can't write both statsFile and outFile to stdout\n");
+    fprintf(stderr, "  --engine : How to step the hardware model (all but functional produce the same results).\n");
+    fprintf(stderr, "      If --engine or --functional is given more than once, the last one wins\n");
+    fprintf(stderr, "      scan : visit every node and edge in every step (default)\n");
+    fprintf(stderr, "      active : only visit edges holding messages and nodes that may have changed\n");
+    fprintf(stderr, "      batch : as scan, but using the graph's vectorised edge kernel if it has one\n");
+    fprintf(stderr, "      functional : as --functional\n");
+    fprintf(stderr, "  --threads : Number of threads used by the scan and batch engines (default 1)\n");
+    fprintf(stderr, "  --reorder : Order to store nodes in memory (does not change results)\n");
+    fprintf(stderr, "      none : load order (default)\n");
+    fprintf(stderr, "      rcm : reverse Cuthill-McKee, so neighbours are close together\n");
+    fprintf(stderr, "  --stats-format : Encoding of statsFile\n");
+    fprintf(stderr, "      text : one comma separated line per step (default)\n");
+    fprintf(stderr, "      binary : run-length encoded records, see bin/tools/convert_stats\n");
+    fprintf(stderr, "  --output-format : Encoding of outFile for heat graphs\n");
+    fprintf(stderr, "      mjpeg : one JPEG per output slice (default)\n");
+    fprintf(stderr, "      raw : exact int32 heat of each output device per slice, after an index header (see heat::raw_header)\n");
+    fprintf(stderr, "      rgb : uncompressed 24-bit RGB frames, as ffmpeg's rawvideo rgb24\n");
+    fprintf(stderr, "  --max-slices : Most output slices the supervisor collects at once, holding back devices\n");
+    fprintf(stderr, "      which would need more (default 0, for no limit). Bounds memory, but changes the stats,\n");
+    fprintf(stderr, "      which then end with the peak number of slices in progress\n");
+    fprintf(stderr, "  --compact : Step heat graphs with smaller messages, device state and properties\n");
+    fprintf(stderr, "      (see graphs/heat_compact.hpp). Same results, but the batch engine has no kernel for it\n");
+    fprintf(stderr, "  --functional : Same as --engine functional. Ignore network timing and deliver messages\n");
+    fprintf(stderr, "      immediately. Only gives the same output for timing-independent graphs (e.g. heat),\n");
+    fprintf(stderr, "      and statsFile is left empty\n");
     exit(1);
 }
 
@@ -67,6 +127,7 @@ int main(int argc, char *argv[])
         
         std::istream *src=&std::cin;
         std::ifstream srcFile;
+        const char *srcPath=0;
         
         std::ostream *stats=&std::cout;
         std::ofstream statsFile;
@@ -75,6 +136,8 @@ int main(int argc, char *argv[])
         FILE *dstFile=0;
         
         int logLevel=1;
+        simulator_options options;
+        bool compact=false;
         
         //////////////////////////////////////////////////////////////////////
         // Argument parsing
@@ -90,22 +153,127 @@ int main(int argc, char *argv[])
                 logLevel = atoi(argv[ai+1]);
                 ai+=2;
                 fprintf(stderr, "Set log-level to %d\n", logLevel);
+                if(logLevel > SIMULATOR_MAX_LOG_LEVEL){
+                    fprintf(stderr, "Warning: log levels above %d are not compiled in\n", SIMULATOR_MAX_LOG_LEVEL);
+                }
+            }else if(!strcmp(argv[ai], "--engine")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --engine\n");
+                    exit(1);
+                }
+                if(!strcmp(argv[ai+1], "scan")){
+                    options.engine=simulator_options::engine_scan;
+                }else if(!strcmp(argv[ai+1], "active")){
+                    options.engine=simulator_options::engine_active;
+                }else if(!strcmp(argv[ai+1], "batch")){
+                    options.engine=simulator_options::engine_batch;
+                }else if(!strcmp(argv[ai+1], "functional")){
+                    options.engine=simulator_options::engine_functional;
+                }else{
+                    fprintf(stderr, "Error: Unknown engine '%s'\n", argv[ai+1]);
+                    usage();
+                }
+                ai+=2;
+                fprintf(stderr, "Set engine to %s\n", argv[ai-1]);
+            }else if(!strcmp(argv[ai], "--threads")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --threads\n");
+                    exit(1);
+                }
+                int threads = atoi(argv[ai+1]);
+                if(threads < 1){
+                    fprintf(stderr, "Error: --threads must be at least 1\n");
+                    exit(1);
+                }
+                options.threads = threads;
+                ai+=2;
+                fprintf(stderr, "Set threads to %u\n", options.threads);
+            }else if(!strcmp(argv[ai], "--max-slices")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --max-slices\n");
+                    exit(1);
+                }
+                int maxSlices = atoi(argv[ai+1]);
+                if(maxSlices < 0){
+                    fprintf(stderr, "Error: --max-slices can't be negative\n");
+                    exit(1);
+                }
+                options.maxSlices = maxSlices;
+                ai+=2;
+                fprintf(stderr, "Set max-slices to %u\n", options.maxSlices);
+            }else if(!strcmp(argv[ai], "--reorder")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --reorder\n");
+                    exit(1);
+                }
+                if(!strcmp(argv[ai+1], "none")){
+                    options.reorder=simulator_options::reorder_none;
+                }else if(!strcmp(argv[ai+1], "rcm")){
+                    options.reorder=simulator_options::reorder_rcm;
+                }else{
+                    fprintf(stderr, "Error: Unknown reordering '%s'\n", argv[ai+1]);
+                    usage();
+                }
+                ai+=2;
+                fprintf(stderr, "Set reorder to %s\n", argv[ai-1]);
+            }else if(!strcmp(argv[ai], "--stats-format")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --stats-format\n");
+                    exit(1);
+                }
+                if(!strcmp(argv[ai+1], "text")){
+                    options.statsFormat=StatsWriter::format_text;
+                }else if(!strcmp(argv[ai+1], "binary")){
+                    options.statsFormat=StatsWriter::format_binary;
+                }else{
+                    fprintf(stderr, "Error: Unknown stats format '%s'\n", argv[ai+1]);
+                    usage();
+                }
+                ai+=2;
+                fprintf(stderr, "Set stats-format to %s\n", argv[ai-1]);
+            }else if(!strcmp(argv[ai], "--output-format")){
+                if(argc-ai < 2){
+                    fprintf(stderr, "Error: Missing parameter to --output-format\n");
+                    exit(1);
+                }
+                if(!strcmp(argv[ai+1], "mjpeg")){
+                    options.outputFormat=output_format_mjpeg;
+                }else if(!strcmp(argv[ai+1], "raw")){
+                    options.outputFormat=output_format_raw;
+                }else if(!strcmp(argv[ai+1], "rgb")){
+                    options.outputFormat=output_format_rgb;
+                }else{
+                    fprintf(stderr, "Error: Unknown output format '%s'\n", argv[ai+1]);
+                    usage();
+                }
+                ai+=2;
+                fprintf(stderr, "Set output-format to %s\n", argv[ai-1]);
+            }else if(!strcmp(argv[ai], "--compact")){
+                compact=true;
+                ai++;
+                fprintf(stderr, "Set compact heat encoding\n");
+            }else if(!strcmp(argv[ai], "--functional")){
+                // Alias for --engine functional, so whichever comes last wins
+                options.engine=simulator_options::engine_functional;
+                ai++;
+                fprintf(stderr, "Set engine to functional\n");
             }else if(pi==0){
                 fprintf(stderr, "Setting srcFile to '%s'\n", argv[ai]);
                 if(strcmp(argv[ai], "-")){
-                    srcFile.open(argv[ai], std::ios_base::in);
+                    srcFile.open(argv[ai], std::ios_base::in|std::ios_base::binary);
                     if(!srcFile.is_open()){
                         fprintf(stderr, "Error: Couldn't open source file.\n");
                         exit(1);
                     }
                     src=&srcFile;
+                    srcPath=argv[ai];
                 }
                 ai++;
                 pi++;
             }else if(pi==1){
                 fprintf(stderr, "Setting statsFile to '%s'\n", argv[ai]);
                 if(strcmp(argv[ai], "-")){
-                    statsFile.open(argv[ai], std::ios_base::out|std::ios_base::trunc);
+                    statsFile.open(argv[ai], std::ios_base::out|std::ios_base::trunc|std::ios_base::binary);
                     if(!statsFile.is_open()){
                         fprintf(stderr, "Error: Couldn't open stats file.\n");
                         exit(1);
@@ -132,6 +300,15 @@ int main(int argc, char *argv[])
             }
         }
         
+        if( options.threads>1 && options.engine==simulator_options::engine_active ){
+            fprintf(stderr, "Error: --threads is not supported by the active engine\n");
+            exit(1);
+        }
+        if( options.threads>1 && options.engine==simulator_options::engine_functional ){
+            fprintf(stderr, "Error: --threads is not supported in functional mode\n");
+            exit(1);
+        }
+        
         if( (dst==stdout) && (stats==&std::cout) ){
             fprintf(stderr, "Error: Can't send both stats and output to stdout (send one to /dev/null ?)\n");
             exit(1);
@@ -141,18 +318,45 @@ int main(int argc, char *argv[])
         ///////////////////////////////////////////////////
         // Parsing and execution
         
-        unsigned lineNumber=0;
-        
-        // Read the graph header, containing the type
-        std::string type=graph_load_type(lineNumber, *src);
+        // Compressed input is inflated on a separate thread while we parse
+        std::unique_ptr<GzipInputStream> srcGzip;
+        if(stream_is_gzip(*src)){
+            srcGzip.reset(new GzipInputStream(*src));
+            src=srcGzip.get();
+            srcPath=0;  // Can't map it
+        }
         
-        if(type=="heat"){
-            simulate<heat>(logLevel, lineNumber, *src, *stats, dst);
-        }else if(type=="ring"){
-            simulate<ring>(logLevel, lineNumber, *src, *stats, dst);
+        if(graph_is_binary(*src)){
+            // Map the file directly if we can, otherwise slurp stdin
+            std::unique_ptr<GraphBinaryData> data(srcPath ? new GraphBinaryData(srcPath) : new GraphBinaryData(*src));
+            std::string type=graph_binary_load_type(*data);
+            
+            if(type=="heat" && compact){
+                simulate_binary<heat_compact>(logLevel, options, *data, *stats, dst);
+            }else if(type=="heat"){
+                simulate_binary<heat>(logLevel, options, *data, *stats, dst);
+            }else if(type=="ring"){
+                simulate_binary<ring>(logLevel, options, *data, *stats, dst);
+            }else{
+                fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
+                exit(1);
+            }
         }else{
-            fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
-            exit(1);
+            unsigned lineNumber=0;
+            
+            // Read the graph header, containing the type
+            std::string type=graph_load_type(lineNumber, *src);
+            
+            if(type=="heat" && compact){
+                simulate<heat_compact>(logLevel, options, lineNumber, *src, *stats, dst);
+            }else if(type=="heat"){
+                simulate<heat>(logLevel, options, lineNumber, *src, *stats, dst);
+            }else if(type=="ring"){
+                simulate<ring>(logLevel, options, lineNumber, *src, *stats, dst);
+            }else{
+                fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
+                exit(1);
+            }
         }
         
         
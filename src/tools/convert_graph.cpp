@@ -0,0 +1,139 @@
+#include "graph_builder.hpp"
+#include "graph_loader.hpp"
+#include "graph_binary.hpp"
+#include "graph_collector.hpp"
+#include "gzip_stream.hpp"
+
+#include "graphs/heat.hpp"
+#include "graphs/ring.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <memory>
+
+/* Converts a graph between the POETSGraph text format and the binary format
+   of graph_binary.hpp. The input format is detected automatically, and the
+   input may be gzipped. */
+
+template<class TGraph>
+void convert(
+    const typename TGraph::graph_type &graph,
+    const GraphCollector<TGraph> &collector,
+    graph_format format,
+    std::ostream &dst
+){
+    GraphBuilder<TGraph> builder(graph);
+    for(unsigned i=0; i<collector.nodes.size(); i++){
+        builder.addDevice(collector.nodes[i]);
+    }
+    for(unsigned i=0; i<collector.edges.size(); i++){
+        const typename GraphCollector<TGraph>::edge &e=collector.edges[i];
+        // The loaders pass the (dst,src) columns as addChannel(a,b), while
+        // GraphBuilder writes addChannel(src,dst) as (dst,src), so swap back.
+        builder.addChannel(e.b, e.a, e.delay, e.channel);
+    }
+    builder.write(dst, format);
+}
+
+template<class TGraph>
+void convert_text(unsigned &lineNumber, std::istream &src, graph_format format, std::ostream &dst)
+{
+    typename TGraph::graph_type graph;
+    unsigned numDevices, numChannels;
+    graph_load_header<TGraph>(lineNumber, src, graph, numDevices, numChannels);
+
+    GraphCollector<TGraph> collector;
+    collector.nodes.reserve(numDevices);
+    collector.edges.reserve(numChannels);
+    graph_load_body(lineNumber, src, numDevices, numChannels, collector);
+
+    convert(graph, collector, format, dst);
+}
+
+template<class TGraph>
+void convert_binary(const GraphBinaryData &src, graph_format format, std::ostream &dst)
+{
+    typename TGraph::graph_type graph;
+    unsigned numDevices, numChannels;
+    graph_binary_load_header<TGraph>(src, graph, numDevices, numChannels);
+
+    GraphCollector<TGraph> collector;
+    collector.nodes.reserve(numDevices);
+    collector.edges.reserve(numChannels);
+    graph_binary_load_body(src, numDevices, numChannels, collector);
+
+    convert(graph, collector, format, dst);
+}
+
+int main(int argc, char *argv[])
+{
+    try{
+        std::istream *src=&std::cin;
+        std::ifstream srcFile;
+        const char *srcPath=0;
+
+        if(argc<2 || argc>3){
+            fprintf(stderr, "usage: convert_graph (text|binary) [srcFile|-]\n");
+            fprintf(stderr, "  Writes the graph to stdout in the given format.\n");
+            exit(1);
+        }
+
+        graph_format format;
+        if(!strcmp(argv[1], "text")){
+            format=graph_format_text;
+        }else if(!strcmp(argv[1], "binary")){
+            format=graph_format_binary;
+        }else{
+            fprintf(stderr, "Error: Unknown graph format '%s'\n", argv[1]);
+            exit(1);
+        }
+
+        if(argc>2 && strcmp(argv[2], "-")){
+            srcPath=argv[2];
+            srcFile.open(srcPath, std::ios_base::in|std::ios_base::binary);
+            if(!srcFile.is_open()){
+                fprintf(stderr, "Error: Couldn't open source file.\n");
+                exit(1);
+            }
+            src=&srcFile;
+        }
+
+        std::unique_ptr<GzipInputStream> srcGzip;
+        if(stream_is_gzip(*src)){
+            srcGzip.reset(new GzipInputStream(*src));
+            src=srcGzip.get();
+            srcPath=0;
+        }
+
+        if(graph_is_binary(*src)){
+            std::unique_ptr<GraphBinaryData> data(srcPath ? new GraphBinaryData(srcPath) : new GraphBinaryData(*src));
+            std::string type=graph_binary_load_type(*data);
+
+            if(type=="heat"){
+                convert_binary<heat>(*data, format, std::cout);
+            }else if(type=="ring"){
+                convert_binary<ring>(*data, format, std::cout);
+            }else{
+                fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
+                exit(1);
+            }
+        }else{
+            unsigned lineNumber=0;
+            std::string type=graph_load_type(lineNumber, *src);
+
+            if(type=="heat"){
+                convert_text<heat>(lineNumber, *src, format, std::cout);
+            }else if(type=="ring"){
+                convert_text<ring>(lineNumber, *src, format, std::cout);
+            }else{
+                fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
+                exit(1);
+            }
+        }
+    }catch(std::exception &e){
+        fprintf(stderr, "Exception: %s\n", e.what());
+        exit(1);
+    }
+}
@@ -0,0 +1,48 @@
+#include "stats_writer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+
+/* Converts a binary stats stream (simulator --stats-format binary) back to
+   the comma separated text that the simulator writes by default. */
+
+int main(int argc, char *argv[])
+{
+    try{
+        std::istream *src=&std::cin;
+        std::ifstream srcFile;
+
+        if(argc>2){
+            fprintf(stderr, "usage: convert_stats [srcFile|-]\n");
+            fprintf(stderr, "  Writes the stats as text to stdout.\n");
+            exit(1);
+        }
+        if(argc>1 && strcmp(argv[1], "-")){
+            srcFile.open(argv[1], std::ios_base::in|std::ios_base::binary);
+            if(!srcFile.is_open()){
+                fprintf(stderr, "Error: Couldn't open source file.\n");
+                exit(1);
+            }
+            src=&srcFile;
+        }
+
+        read_stats_header(*src);
+
+        StatsWriter writer(std::cout, StatsWriter::format_text);
+        stats_record record;
+        while(read_stats_record(*src, record)){
+            if(record.count==0){
+                writer.writeSummary(stats_summary_type(record.row.stepIndex), record.row.nodeIdleSteps);
+            }else{
+                writer.writeRows(record.row, record.count);
+            }
+        }
+        writer.flush();
+    }catch(std::exception &e){
+        fprintf(stderr, "Exception: %s\n", e.what());
+        exit(1);
+    }
+}
@@ -0,0 +1,197 @@
+#include "graph_builder.hpp"
+#include "device_rng.hpp"
+#include "graphs/heat.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+/* Generates a heat graph on a hexagonal grid, following generate_heat_hex.m,
+   but written as it is generated so it scales to very large graphs.
+
+   Cells live on a (2*size) x size lattice, where only cells with x+y odd are
+   devices, giving size*size devices each with up to six neighbours at
+   (x-1,y-1), (x-2,y), (x-1,y+1), (x+1,y+1), (x+2,y), (x+1,y-1). Devices are
+   numbered column by column. The random properties of each device come from
+   its own device_rng, so the edge pass can recreate the weights chosen in
+   the node pass.
+
+   The device properties differ from the script's in three ways:
+   - The script draws the lattice on a 256x128 image, scaling x and y both
+     by pixW/w, so a lattice row is as tall as a column is wide. Here the
+     image is square and each axis is scaled to fill it, so a row is twice
+     as tall as a column is wide. That stretches the picture vertically
+     relative to the script's, but is closer to regular hexagons (a ratio
+     of sqrt(3)).
+   - The script's Dirichlet test has y==w, which never holds as h<w, so its
+     last row is left free. Here the boundary is fixed on all four sides,
+     with y==h.
+   - The random values come from device_rng, so they don't match the
+     script's rand() sequence.
+*/
+
+struct hex_layout
+{
+    unsigned w, h;  // Lattice is [1,w] x [1,h], as in the script
+
+    bool contains(int x, int y) const
+    { return x>=1 && x<=int(w) && y>=1 && y<=int(h); }
+
+    unsigned index_of(unsigned x, unsigned y) const
+    {
+        unsigned oddColumns=x/2, evenColumns=(x-1)/2;   // Columns in [1,x)
+        unsigned before=oddColumns*(h/2) + evenColumns*((h+1)/2);
+        return before + ((x%2) ? y/2-1 : (y-1)/2);
+    }
+
+    unsigned num_devices() const
+    { return (w/2+w%2)*(h/2) + (w/2)*((h+1)/2); }
+
+    // Neighbours of (x,y) which are in the lattice, in the order of the script
+    unsigned neighbours(unsigned x, unsigned y, int (*nhood)[2]) const
+    {
+        static const int offsets[6][2]={ {-1,-1}, {-2,0}, {-1,+1}, {+1,+1}, {+2,0}, {+1,-1} };
+        unsigned n=0;
+        for(unsigned i=0; i<6; i++){
+            int nx=int(x)+offsets[i][0], ny=int(y)+offsets[i][1];
+            if(contains(nx,ny)){
+                nhood[n][0]=nx;
+                nhood[n][1]=ny;
+                n++;
+            }
+        }
+        return n;
+    }
+};
+
+// Random choices made for one device, which both passes need
+struct hex_device
+{
+    double selfWeight;
+    double inputWeights[6];
+    unsigned inputDelays[6];
+    bool isOutput;
+
+    hex_device(uint64_t seed, unsigned index, unsigned nhoodSize, unsigned outputDeltaSpace)
+    {
+        device_rng rng(seed, index);
+        selfWeight=rng.uniform()*0.2+0.6;
+        double sum=0;
+        for(unsigned i=0; i<nhoodSize; i++){
+            inputWeights[i]=rng.uniform()*0.4+0.6;
+            sum+=inputWeights[i];
+        }
+        for(unsigned i=0; i<nhoodSize; i++){
+            inputWeights[i]=(1-selfWeight)*inputWeights[i]/sum;
+            inputDelays[i]=unsigned(rng.uniform()*6);
+        }
+        isOutput = rng.uniform() < 1.0/outputDeltaSpace;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    try{
+        graph_format format=graph_format_text;
+        if(argc>1 && !strcmp(argv[argc-1], "--binary")){
+            format=graph_format_binary;
+            argc--;
+        }
+
+        unsigned size=64;
+        unsigned maxTime=64;
+        unsigned outputDeltaSpace=2;
+        unsigned outputDeltaTime=8;
+        uint64_t seed=1;
+        int minHeat=-8000, maxHeat=+8000;
+
+        if(argc>1){
+            size=atoi(argv[1]);
+        }
+        if(argc>2){
+            maxTime=atoi(argv[2]);
+        }
+        if(argc>3){
+            outputDeltaTime=atoi(argv[3]);
+        }
+        if(argc>4){
+            outputDeltaSpace=atoi(argv[4]);
+        }
+        if(argc>5){
+            seed=strtoull(argv[5], 0, 0);
+        }
+        if(size<2 || outputDeltaTime<1 || outputDeltaSpace<1){
+            fprintf(stderr, "usage: generate_heat_hex [size] [maxTime] [outputDeltaTime] [outputDeltaSpace] [seed] [--binary]\n");
+            exit(1);
+        }
+
+        hex_layout layout{2*size, size};
+
+        unsigned pixelSize=std::min(1024u, std::max(256u, 4*size));
+        pixelSize=((pixelSize+3)/4)*4;
+
+        heat::graph_type graph{
+            "hex",
+            uint16_t(pixelSize), uint16_t(pixelSize),
+            maxTime,
+            outputDeltaTime,
+            minHeat,
+            maxHeat
+        };
+
+        int nhood[6][2];
+
+        unsigned numDevices=layout.num_devices();
+        unsigned numChannels=0;
+        for(unsigned x=1; x<=layout.w; x++){
+            for(unsigned y=1+(x%2); y<=layout.h; y+=2){
+                numChannels+=layout.neighbours(x, y, nhood);
+            }
+        }
+
+        GraphStreamBuilder<heat> dst(std::cout, graph, numDevices, numChannels, format);
+
+        for(unsigned x=1; x<=layout.w; x++){
+            for(unsigned y=1+(x%2); y<=layout.h; y+=2){
+                unsigned index=layout.index_of(x, y);
+                unsigned nhoodSize=layout.neighbours(x, y, nhood);
+                hex_device device(seed, index, nhoodSize, outputDeltaSpace);
+
+                heat::properties_type properties{
+                    index+1,
+                    nhoodSize,
+                    uint16_t(std::lround(x/double(layout.w) * (pixelSize-1))),
+                    uint16_t(std::lround(y/double(layout.h) * (pixelSize-1))),
+                    int32_t(std::lround(device.selfWeight*65536)),
+                    int32_t(std::lround(std::sin(x/double(layout.w)+y/double(layout.h))*65536)),
+                    x==1 || x==layout.w || y==1 || y==layout.h,
+                    device.isOutput
+                };
+                dst.addDevice(properties);
+            }
+        }
+
+        for(unsigned x=1; x<=layout.w; x++){
+            for(unsigned y=1+(x%2); y<=layout.h; y+=2){
+                unsigned index=layout.index_of(x, y);
+                unsigned nhoodSize=layout.neighbours(x, y, nhood);
+                hex_device device(seed, index, nhoodSize, outputDeltaSpace);
+
+                for(unsigned i=0; i<nhoodSize; i++){
+                    dst.addChannel(
+                        layout.index_of(nhood[i][0], nhood[i][1]),
+                        index,
+                        device.inputDelays[i],
+                        heat::channel_type{ int32_t(std::lround(device.inputWeights[i]*65536)) }
+                    );
+                }
+            }
+        }
+
+        dst.finish();
+    }catch(std::exception &e){
+        fprintf(stderr, "Exception: %s\n", e.what());
+        exit(1);
+    }
+}
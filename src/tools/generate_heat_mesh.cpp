@@ -0,0 +1,213 @@
+#include "graph_builder.hpp"
+#include "device_rng.hpp"
+#include "delaunay.hpp"
+#include "graphs/heat.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+/* Generates a heat graph on an unstructured disc mesh, as generate_heat_mesh.m
+   does, but natively so that it scales to millions of cells.
+
+   The disc has a ring of floor(sqrt(8*numCell)) Dirichlet boundary points,
+   followed by the interior points, which are drawn uniformly from the square,
+   kept if inside the disc, and then pushed outwards by taking the square root
+   of their radius. Connectivity is the Delaunay triangulation of all of them,
+   and each device weights and delays its inputs by distance as the script does.
+
+   Points are snapped to a 2^22 grid across the unit radius, so that the
+   triangulation can be done exactly; interior points which land on top of an
+   earlier point are dropped. Interior points come from one stream, and the
+   per-device choices from each device's own device_rng.
+*/
+
+static const double GRID_SCALE=double(1<<22);
+
+int main(int argc, char *argv[])
+{
+    try{
+        graph_format format=graph_format_text;
+        if(argc>1 && !strcmp(argv[argc-1], "--binary")){
+            format=graph_format_binary;
+            argc--;
+        }
+
+        unsigned numCell=1024;
+        uint64_t seed=1;
+        int minHeat=-10000, maxHeat=+10000;
+
+        if(argc>1){
+            numCell=atoi(argv[1]);
+        }
+        unsigned maxTime=numCell;
+        unsigned outputDeltaTime=std::max(1u, maxTime/100);
+        unsigned outputDeltaSpace=std::max(1u, numCell/8192);
+        if(argc>2){
+            maxTime=atoi(argv[2]);
+            outputDeltaTime=std::max(1u, maxTime/100);
+        }
+        if(argc>3){
+            outputDeltaTime=atoi(argv[3]);
+        }
+        if(argc>4){
+            outputDeltaSpace=atoi(argv[4]);
+        }
+        if(argc>5){
+            seed=strtoull(argv[5], 0, 0);
+        }
+        if(numCell<1 || outputDeltaTime<1 || outputDeltaSpace<1){
+            fprintf(stderr, "usage: generate_heat_mesh [numCell] [maxTime] [outputDeltaTime] [outputDeltaSpace] [seed] [--binary]\n");
+            exit(1);
+        }
+
+        unsigned pixelSize=std::max(512u, unsigned(std::ceil(5*std::sqrt(double(numCell)))));
+        pixelSize=((pixelSize+3)/4)*4;
+        if(pixelSize>65535){
+            throw std::runtime_error("Too many cells for a 16-bit image size.");
+        }
+
+        unsigned numBoundary=unsigned(std::floor(std::sqrt(8.0*numCell)));
+
+        std::vector<int64_t> gx, gy;
+        gx.reserve(numBoundary+numCell);
+        gy.reserve(numBoundary+numCell);
+        for(unsigned i=0; i<numBoundary; i++){
+            double u=i/double(numBoundary);
+            gx.push_back(std::llround(std::sin(u*2*M_PI)*GRID_SCALE));
+            gy.push_back(std::llround(std::cos(u*2*M_PI)*GRID_SCALE));
+        }
+
+        device_rng pointRng(seed, 0);
+        for(unsigned i=0; i<numCell; i++){
+            double ix=pointRng.uniform()*2-1;
+            double iy=pointRng.uniform()*2-1;
+            double r2=ix*ix+iy*iy;
+            if(r2>=1 || r2==0)
+                continue;
+            // Radius goes to its square root, keeping the angle
+            double scale=std::sqrt(std::sqrt(r2))/std::sqrt(r2);
+            gx.push_back(std::llround(ix*scale*GRID_SCALE));
+            gy.push_back(std::llround(iy*scale*GRID_SCALE));
+        }
+
+        // Drop any interior point which snapped onto an earlier one
+        {
+            std::vector<uint32_t> byPos(gx.size());
+            for(uint32_t i=0; i<byPos.size(); i++){
+                byPos[i]=i;
+            }
+            std::sort(byPos.begin(), byPos.end(), [&](uint32_t a, uint32_t b){
+                if(gx[a]!=gx[b]) return gx[a]<gx[b];
+                if(gy[a]!=gy[b]) return gy[a]<gy[b];
+                return a<b;
+            });
+            std::vector<bool> duplicate(gx.size(), false);
+            for(uint32_t i=1; i<byPos.size(); i++){
+                if(gx[byPos[i]]==gx[byPos[i-1]] && gy[byPos[i]]==gy[byPos[i-1]]){
+                    duplicate[byPos[i]]=true;
+                }
+            }
+            uint32_t kept=0;
+            for(uint32_t i=0; i<gx.size(); i++){
+                if(!duplicate[i]){
+                    gx[kept]=gx[i];
+                    gy[kept]=gy[i];
+                    kept++;
+                }
+            }
+            gx.resize(kept);
+            gy.resize(kept);
+        }
+
+        fprintf(stderr, "Triangulating.\n");
+        std::vector<std::pair<uint32_t,uint32_t> > edges=delaunay_edges(gx, gy);
+
+        // Neighbours of each device in ascending order, which is the order
+        // the script finds them in its sorted edge list
+        unsigned numDevices=gx.size();
+        std::vector<uint32_t> nhoodBegin(numDevices+1, 0);
+        for(const auto &e : edges){
+            nhoodBegin[e.first+1]++;
+            nhoodBegin[e.second+1]++;
+        }
+        for(unsigned i=0; i<numDevices; i++){
+            nhoodBegin[i+1]+=nhoodBegin[i];
+        }
+        std::vector<uint32_t> nhood(nhoodBegin[numDevices]);
+        {
+            std::vector<uint32_t> fill(nhoodBegin.begin(), nhoodBegin.end()-1);
+            for(const auto &e : edges){
+                nhood[fill[e.first]++]=e.second;
+                nhood[fill[e.second]++]=e.first;
+            }
+        }
+        std::vector<std::pair<uint32_t,uint32_t> >().swap(edges);
+
+        heat::graph_type graph{
+            "mesh",
+            uint16_t(pixelSize), uint16_t(pixelSize),
+            maxTime,
+            outputDeltaTime,
+            minHeat,
+            maxHeat
+        };
+
+        GraphStreamBuilder<heat> dst(std::cout, graph, numDevices, nhood.size(), format);
+
+        for(unsigned i=0; i<numDevices; i++){
+            device_rng rng(seed, 1+uint64_t(i));
+            double selfWeight=rng.uniform()*0.2+0.6;
+            bool isOutput=rng.uniform() < 1.0/outputDeltaSpace;
+
+            double x=gx[i]/GRID_SCALE, y=gy[i]/GRID_SCALE;
+
+            heat::properties_type properties{
+                i+1,
+                nhoodBegin[i+1]-nhoodBegin[i],
+                uint16_t(std::max(0.0, std::round(pixelSize*(x/2+0.5)))),
+                uint16_t(std::max(0.0, std::round(pixelSize*(y/2+0.5)))),
+                int32_t(std::lround(selfWeight*65536)),
+                int32_t(std::lround(std::sin(x+y)*65536)),
+                i<numBoundary,
+                isOutput
+            };
+            dst.addDevice(properties);
+        }
+
+        std::vector<double> dists;
+        for(unsigned i=0; i<numDevices; i++){
+            device_rng rng(seed, 1+uint64_t(i));
+            double selfWeight=rng.uniform()*0.2+0.6;
+
+            unsigned begin=nhoodBegin[i], nhoodSize=nhoodBegin[i+1]-begin;
+            dists.resize(nhoodSize);
+            double sumDists=0, maxDist=0;
+            for(unsigned j=0; j<nhoodSize; j++){
+                uint32_t src=nhood[begin+j];
+                dists[j]=std::hypot(double(gx[i]-gx[src]), double(gy[i]-gy[src]))/GRID_SCALE;
+                sumDists+=dists[j];
+                maxDist=std::max(maxDist, dists[j]);
+            }
+            // sum(1-normDists) over the neighbourhood, which only a lone neighbour can make zero
+            double sumRest=std::max(1u, nhoodSize-1);
+
+            for(unsigned j=0; j<nhoodSize; j++){
+                double normDist=dists[j]/sumDists;
+                double weight=(1-selfWeight)*(1-normDist)/sumRest;
+                dst.addChannel(
+                    nhood[begin+j],
+                    i,
+                    unsigned(std::floor(4*dists[j]/maxDist)),
+                    heat::channel_type{ int32_t(std::lround(weight*65536)) }
+                );
+            }
+        }
+
+        dst.finish();
+    }catch(std::exception &e){
+        fprintf(stderr, "Exception: %s\n", e.what());
+        exit(1);
+    }
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <random>
 #include <iostream> 
+#include <cstring>
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -12,6 +13,11 @@
 int main(int argc, char *argv[])
 {
     try{
+        graph_format format=graph_format_text;
+        if(argc>1 && !strcmp(argv[argc-1], "--binary")){
+            format=graph_format_binary;
+            argc--;
+        }
         
         unsigned w=65, h=65;
         unsigned maxTime=64;
@@ -32,6 +38,19 @@ int main(int argc, char *argv[])
         if(argc>4){
             outputDeltaSpace=atoi(argv[4]);
         }
+        uint32_t seed=std::mt19937::default_seed;
+        if(argc>5){
+            seed=strtoul(argv[5], 0, 0);
+        }
+        // If given, every channel has this delay rather than a random one, as
+        // for a network where each hop crosses the same slow link. Devices
+        // then move in lockstep, and in linkDelay-1 of every linkDelay+1
+        // steps there are only messages in transit, which the simulator
+        // skips over (see Simulator::quiescent_steps).
+        int linkDelay=-1;
+        if(argc>6){
+            linkDelay=atoi(argv[6]);
+        }
         
         w= std::max(1u, (w/outputDeltaSpace))*outputDeltaSpace+1;
         h= std::max(1u, (h/outputDeltaSpace))*outputDeltaSpace+1;
@@ -42,7 +61,7 @@ int main(int argc, char *argv[])
         pixelWidth = ((pixelWidth+3)/4)*4;
         pixelHeight = ((pixelHeight+3)/4)*4;
         
-        std::mt19937 urng;
+        std::mt19937 urng(seed);
         
         
         heat::graph_type graph{
@@ -54,9 +73,12 @@ int main(int argc, char *argv[])
             maxHeat
         };
         
-        GraphBuilder<heat> sim(graph);
+        // Devices are all added before channels, so the graph can be written as it is built
+        unsigned numDevices=w*h;
+        unsigned numChannels=2*(w-1)*h + 2*w*(h-1);
+        GraphStreamBuilder<heat> sim(std::cout, graph, numDevices, numChannels, format);
         
-        std::unordered_map<unsigned,unsigned> idToNodeIndex;
+        std::vector<unsigned> idToNodeIndex(numDevices);
         
         float selfWeight = 0.5f;
         float otherWeight = (1-selfWeight)/4;
@@ -99,6 +121,9 @@ int main(int argc, char *argv[])
                 delay++;
                 u=u>>1;
             }
+            if(linkDelay>=0){
+                delay=linkDelay;
+            }
             
             sim.addChannel(
                 idToNodeIndex[srcIdx],
@@ -127,7 +152,7 @@ int main(int argc, char *argv[])
             }
         }        
         
-        sim.write(std::cout);
+        sim.finish();
     }catch(...){
         std::cerr<<"Caught exception\n";
         exit(1);
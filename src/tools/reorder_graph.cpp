@@ -0,0 +1,96 @@
+#include "graph_builder.hpp"
+#include "graph_loader.hpp"
+#include "graph_reorder.hpp"
+#include "graph_collector.hpp"
+
+#include "graphs/heat.hpp"
+#include "graphs/ring.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+/* Rewrites a graph with its nodes in reverse Cuthill-McKee order, so that
+   neighbouring devices are close together in the file (and so in memory
+   once loaded). Edges keep their original order, so each device still
+   sees its inputs in the same order.
+
+   Note that the supervisor orders output devices by position in the file,
+   so pixels which are exactly equidistant from two output devices may be
+   coloured from a different one of them.
+*/
+
+template<class TGraph>
+void reorder(unsigned &lineNumber, std::istream &src, std::ostream &dst)
+{
+    typename TGraph::graph_type graph;
+    unsigned numDevices, numChannels;
+
+    graph_load_header<TGraph>(lineNumber, src, graph, numDevices, numChannels);
+
+    GraphCollector<TGraph> collector;
+    collector.nodes.reserve(numDevices);
+    collector.edges.reserve(numChannels);
+    graph_load_body(lineNumber, src, numDevices, numChannels, collector);
+
+    std::vector<uint32_t> edgeA(numChannels), edgeB(numChannels);
+    for(unsigned i=0; i<numChannels; i++){
+        edgeA[i]=collector.edges[i].a;
+        edgeB[i]=collector.edges[i].b;
+    }
+    std::vector<uint32_t> order=reverse_cuthill_mckee(numDevices, edgeA, edgeB);
+    std::vector<uint32_t> rank(numDevices);
+    for(unsigned i=0; i<numDevices; i++){
+        rank[order[i]]=i;
+    }
+
+    GraphBuilder<TGraph> builder(graph);
+    for(unsigned i=0; i<numDevices; i++){
+        builder.addDevice(collector.nodes[order[i]]);
+    }
+    for(unsigned i=0; i<numChannels; i++){
+        const typename GraphCollector<TGraph>::edge &e=collector.edges[i];
+        // graph_load_body passes (dst,src) columns as addChannel(a,b), while
+        // GraphBuilder writes addChannel(src,dst) as (dst,src), so swap back.
+        builder.addChannel(rank[e.b], rank[e.a], e.delay, e.channel);
+    }
+    builder.write(dst);
+}
+
+int main(int argc, char *argv[])
+{
+    try{
+        std::istream *src=&std::cin;
+        std::ifstream srcFile;
+
+        if(argc>2){
+            fprintf(stderr, "usage: reorder_graph [srcFile|-]\n");
+            fprintf(stderr, "  Writes the reordered graph to stdout.\n");
+            exit(1);
+        }
+        if(argc>1 && strcmp(argv[1], "-")){
+            srcFile.open(argv[1], std::ios_base::in);
+            if(!srcFile.is_open()){
+                fprintf(stderr, "Error: Couldn't open source file.\n");
+                exit(1);
+            }
+            src=&srcFile;
+        }
+
+        unsigned lineNumber=0;
+        std::string type=graph_load_type(lineNumber, *src);
+
+        if(type=="heat"){
+            reorder<heat>(lineNumber, *src, std::cout);
+        }else if(type=="ring"){
+            reorder<ring>(lineNumber, *src, std::cout);
+        }else{
+            fprintf(stderr, "Error: Unknown graph type '%s'\n", type.c_str());
+            exit(1);
+        }
+    }catch(std::exception &e){
+        fprintf(stderr, "Exception: %s\n", e.what());
+        exit(1);
+    }
+}